@@ -0,0 +1,432 @@
+// Render benchmark. Renders the obj/ models for every combination of the
+// requested resolutions and shaders and reports per stage timings. Results
+// can be saved as a flat JSON baseline and later runs compared against it.
+#include <vector>
+#include <string>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <dirent.h>
+#include "tgaimage.h"
+#include "model.h"
+#include "renderer.h"
+#include "shader.h"
+#include "raster.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0.;
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n/2] : .5*(v[n/2-1] + v[n/2]);
+}
+
+static std::vector<std::string> split(const std::string &s, char sep)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, sep))
+        if (!item.empty())
+            out.push_back(item);
+    return out;
+}
+
+// All .obj files in dir, sorted so keys are stable between runs
+static std::vector<std::string> findModels(const char *dir)
+{
+    std::vector<std::string> models;
+    if (DIR *d = opendir(dir))
+    {
+        while (dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name.size() > 4 && name.compare(name.size()-4, 4, ".obj") == 0)
+                models.push_back(std::string(dir) + "/" + name);
+        }
+        closedir(d);
+    }
+    std::sort(models.begin(), models.end());
+    return models;
+}
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash+1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static ModelShader* makeShader(const std::string &name, Model *model)
+{
+    Vec3f light(-1.f, -1.f, -1.f);
+    if (name == "simple")
+        return new SimpleModelShader(model, light);
+    if (name == "simpletexture")
+        return new SimpleTextureModelShader(model, light);
+    if (name == "texture")
+        return new TextureModelShader(model, light);
+    return nullptr;
+}
+
+// Baselines are a single flat JSON object of "key": number pairs
+static bool readBaseline(const char *filename, std::map<std::string, double> &values)
+{
+    std::ifstream in(filename);
+    if (!in)
+        return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string s = ss.str();
+
+    size_t pos = 0;
+    while ((pos = s.find('"', pos)) != std::string::npos)
+    {
+        size_t end = s.find('"', pos+1);
+        size_t colon = end == std::string::npos ? end : s.find(':', end);
+        if (colon == std::string::npos)
+            return false;
+        values[s.substr(pos+1, end-pos-1)] = strtod(s.c_str() + colon + 1, nullptr);
+        pos = s.find_first_of(",}", colon);
+        if (pos == std::string::npos)
+            break;
+    }
+    return true;
+}
+
+static bool writeBaseline(const char *filename, const std::map<std::string, double> &values)
+{
+    std::ofstream out(filename);
+    if (!out)
+        return false;
+    out << "{\n";
+    size_t i = 0;
+    for (auto &kv : values)
+    {
+        char num[32];
+        snprintf(num, sizeof(num), "%.4f", kv.second);
+        out << "  \"" << kv.first << "\": " << num << (++i < values.size() ? "," : "") << "\n";
+    }
+    out << "}\n";
+    return (bool)out;
+}
+
+static void usage()
+{
+    std::cerr <<
+        "usage: renderbench [options]\n"
+        "  --model FILE[,FILE..]    models to render, default every obj/*.obj\n"
+        "  --res WxH[,WxH..]        resolutions, default 800x800\n"
+        "  --shader NAME[,NAME..]   simple, simpletexture, texture or all (default)\n"
+        "  --reps N                 timed frames per configuration, default 5\n"
+        "  --tiled [N]              tiled rendering with N threads, default all cores\n"
+        "  --simd                   SIMD rasterization backend\n"
+        "  --depth MODE             late, early (default) or deferred depth testing\n"
+        "  --hiz                    hierarchical Z occlusion rejection\n"
+        "  --cull MODE              none (default), back or front face culling\n"
+        "  --lod PIXELS             generate levels of detail and pick them for PIXELS per triangle\n"
+        "  --vrs N                  shade once per NxN pixel block, N is 1 (default), 2 or 4\n"
+        "  --msaa N                 N samples per pixel, 1 (default), 4 or 8\n"
+        "  --normals SPACE          normal map in object (default) or tangent space\n"
+        "  --shadow N               render an NxN shadow map every frame, 0 (default) for none\n"
+        "  --baseline FILE          compare against a saved baseline\n"
+        "  --tolerance PCT          allowed slowdown against the baseline, default 10\n"
+        "  --save FILE              write the results as a new baseline\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> models;
+    std::vector<std::string> resolutions = {"800x800"};
+    std::vector<std::string> shaders = {"simple", "simpletexture", "texture"};
+    int reps = 5;
+    bool tiled = false;
+    int threads = 0;
+    bool simd = false;
+    std::string depth = "early";
+    bool hiz = false;
+    std::string cull = "none";
+    float lodPixels = 0.f;
+    int vrs = 1;
+    int msaa = 1;
+    int shadowSize = 0;
+    std::string normals = "object";
+    const char *baseline = nullptr;
+    const char *save = nullptr;
+    double tolerance = 10.;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if (arg == "--model" && hasValue)
+            models = split(argv[++i], ',');
+        else if (arg == "--res" && hasValue)
+            resolutions = split(argv[++i], ',');
+        else if (arg == "--shader" && hasValue)
+        {
+            std::string s = argv[++i];
+            if (s != "all")
+                shaders = split(s, ',');
+        }
+        else if (arg == "--reps" && hasValue)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (arg == "--tiled")
+        {
+            tiled = true;
+            if (hasValue && isdigit((unsigned char)argv[i+1][0]))
+                threads = atoi(argv[++i]);
+        }
+        else if (arg == "--simd")
+            simd = true;
+        else if (arg == "--depth" && hasValue)
+            depth = argv[++i];
+        else if (arg == "--hiz")
+            hiz = true;
+        else if (arg == "--cull" && hasValue)
+            cull = argv[++i];
+        else if (arg == "--lod" && hasValue)
+            lodPixels = atof(argv[++i]);
+        else if (arg == "--vrs" && hasValue)
+            vrs = atoi(argv[++i]);
+        else if (arg == "--msaa" && hasValue)
+            msaa = atoi(argv[++i]);
+        else if (arg == "--normals" && hasValue)
+            normals = argv[++i];
+        else if (arg == "--shadow" && hasValue)
+            shadowSize = std::max(0, atoi(argv[++i]));
+        else if (arg == "--baseline" && hasValue)
+            baseline = argv[++i];
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = atof(argv[++i]);
+        else if (arg == "--save" && hasValue)
+            save = argv[++i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    if (models.empty())
+        models = findModels("obj");
+    if (models.empty())
+    {
+        std::cerr << "no models found" << std::endl;
+        return 2;
+    }
+    for (auto &s : shaders)
+        if (s != "simple" && s != "simpletexture" && s != "texture")
+        {
+            std::cerr << "unknown shader " << s << std::endl;
+            return 2;
+        }
+
+    Renderer::DepthMode depthMode;
+    if (depth == "late")
+        depthMode = Renderer::LATE_Z;
+    else if (depth == "early")
+        depthMode = Renderer::EARLY_Z;
+    else if (depth == "deferred")
+        depthMode = Renderer::DEFERRED;
+    else
+    {
+        std::cerr << "unknown depth mode " << depth << std::endl;
+        return 2;
+    }
+
+    Renderer::CullMode cullMode;
+    if (cull == "none")
+        cullMode = Renderer::CULL_NONE;
+    else if (cull == "back")
+        cullMode = Renderer::CULL_BACK;
+    else if (cull == "front")
+        cullMode = Renderer::CULL_FRONT;
+    else
+    {
+        std::cerr << "unknown cull mode " << cull << std::endl;
+        return 2;
+    }
+
+    if (vrs != Renderer::RATE_1X1 && vrs != Renderer::RATE_2X2 && vrs != Renderer::RATE_4X4)
+    {
+        std::cerr << "unknown shading rate " << vrs << std::endl;
+        return 2;
+    }
+    if (msaa != 1 && msaa != 4 && msaa != 8)
+    {
+        std::cerr << "unsupported sample count " << msaa << std::endl;
+        return 2;
+    }
+
+    if (normals != "object" && normals != "tangent")
+    {
+        std::cerr << "unknown normal map space " << normals << std::endl;
+        return 2;
+    }
+
+    std::cerr << "backend " << (simd ? simdBackendName() : "scalar")
+              << (tiled ? ", tiled" : "") << (hiz ? ", hiz" : "") << ", " << depth << " z, cull " << cull << (lodPixels > 0.f ? ", lod" : "") << (vrs > 1 ? ", vrs " + std::to_string(vrs) + "x" + std::to_string(vrs) : "") << (msaa > 1 ? ", msaa " + std::to_string(msaa) + "x" : "") << (shadowSize ? ", shadow " + std::to_string(shadowSize) : "") << (normals == "tangent" ? ", tangent space normals" : "") << ", " << reps << " reps, median times in ms" << std::endl;
+    printf("%-36s %8s %8s %8s %8s %8s %8s %12s %12s %10s %9s\n",
+           "config", "load", "vertex", "raster", "fragment", "tga", "frame", "tris/s", "pixels/s", "fragments", "rejected");
+
+    std::map<std::string, double> results;
+    for (auto &path : models)
+    {
+        auto start = Clock::now();
+        Model model(path.c_str());
+        if (lodPixels > 0.f)
+            model.generateLods();
+        if (normals == "tangent" && !model.setNormalMapSpace(Model::TANGENT_SPACE))
+            std::cerr << "no tangent space normal map for " << path << std::endl;
+        double loadMs = msSince(start);
+        results[baseName(path) + ".load_ms"] = loadMs;
+
+        for (auto &res : resolutions)
+        {
+            int width = 0, height = 0;
+            if (sscanf(res.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+            {
+                std::cerr << "bad resolution " << res << std::endl;
+                return 2;
+            }
+
+            TGAImage image(width, height, TGAImage::RGB);
+            Renderer r(image, &model);
+            r.setBackend(simd ? Renderer::SIMD : Renderer::SCALAR);
+            r.setDepthMode(depthMode);
+            r.setHierarchicalZ(hiz);
+            r.setCullMode(cullMode);
+            r.setLodSelection(lodPixels);
+            r.setShadingRate((Renderer::ShadingRate)vrs);
+            r.setMultisample(msaa);
+            if (tiled)
+                r.setTiledRendering(true, threads);
+            ShadowMap shadowMap(std::max(shadowSize, 1));
+            shadowMap.setLight(Vec3f(-1.f, -1.f, -1.f), model.boundingSphere());
+
+            for (auto &shaderName : shaders)
+            {
+                r.setShader(makeShader(shaderName, &model));
+                if (shadowSize)
+                    r.setShadowMap(&shadowMap);
+                std::string key = baseName(path) + "/" + res + "/" + shaderName;
+
+                // One untimed frame to warm caches and size the buffers
+                r.clear();
+                r.drawModel();
+
+                std::vector<double> vertex, raster, frame, tga, shadow;
+                Renderer::RenderStats stats = {};
+                for (int i = 0; i < reps; i++)
+                {
+                    // The map pass counts towards the frame
+                    double shadowMs = 0.;
+                    if (shadowSize)
+                    {
+                        start = Clock::now();
+                        shadowMap.clear();
+                        shadowMap.render(&model);
+                        shadowMs = msSince(start);
+                    }
+                    shadow.push_back(shadowMs);
+                    r.clear();
+                    r.drawModel();
+                    stats = r.renderStats();
+                    vertex.push_back(stats.vertexMs);
+                    raster.push_back(stats.rasterMs);
+                    frame.push_back(shadowMs + stats.vertexMs + stats.rasterMs);
+
+                    start = Clock::now();
+                    image.flip_vertically();
+                    image.write_tga_file("bench_output.tga");
+                    tga.push_back(msSince(start));
+                }
+
+                // Timing every fragment slows the frame down, so it gets
+                // its own frame outside the timed ones
+                r.setProfileFragments(true);
+                r.clear();
+                r.drawModel();
+                double fragmentMs = r.renderStats().fragmentMs;
+                r.setProfileFragments(false);
+
+                double frameMs = median(frame);
+                double trisPerSec = frameMs > 0. ? stats.triangles / frameMs * 1000. : 0.;
+                double pixelsPerSec = frameMs > 0. ? stats.pixels / frameMs * 1000. : 0.;
+                printf("%-36s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %12.0f %12.0f %10ld %9ld\n",
+                       key.c_str(), loadMs, median(vertex), median(raster), fragmentMs,
+                       median(tga), frameMs, trisPerSec, pixelsPerSec, stats.fragments, stats.rejectedTriangles);
+
+                results[key + ".vertex_ms"] = median(vertex);
+                results[key + ".raster_ms"] = median(raster);
+                results[key + ".fragment_ms"] = fragmentMs;
+                results[key + ".tga_ms"] = median(tga);
+                results[key + ".frame_ms"] = frameMs;
+                if (shadowSize)
+                    results[key + ".shadow_ms"] = median(shadow);
+            }
+        }
+    }
+
+    if (save)
+    {
+        if (!writeBaseline(save, results))
+        {
+            std::cerr << "can't write " << save << std::endl;
+            return 2;
+        }
+        std::cerr << "baseline written to " << save << std::endl;
+    }
+
+    if (!baseline)
+        return 0;
+
+    std::map<std::string, double> reference;
+    if (!readBaseline(baseline, reference))
+    {
+        std::cerr << "can't read baseline " << baseline << std::endl;
+        return 2;
+    }
+
+    // Only whole frame and load times gate, the per stage numbers are too
+    // noisy on their own
+    int regressions = 0;
+    for (auto &kv : results)
+    {
+        const std::string &key = kv.first;
+        bool gated = key.size() > 9 && (key.compare(key.size()-9, 9, ".frame_ms") == 0 || key.compare(key.size()-8, 8, ".load_ms") == 0);
+        auto ref = reference.find(key);
+        if (!gated || ref == reference.end() || ref->second <= 0.)
+            continue;
+        double change = (kv.second / ref->second - 1.) * 100.;
+        if (change > tolerance)
+        {
+            printf("REGRESSION %-36s %8.2f -> %8.2f ms (%+.1f%%)\n", key.c_str(), ref->second, kv.second, change);
+            regressions++;
+        }
+    }
+    if (regressions)
+    {
+        std::cerr << regressions << " regression(s) over " << tolerance << "% against " << baseline << std::endl;
+        return 1;
+    }
+    std::cerr << "no regressions against " << baseline << std::endl;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "depthbuffer.h"
+#include <cstdlib>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const size_t ALIGNMENT = 64;
+
+DepthBuffer::DepthBuffer()
+    :DepthBuffer(0, 0)
+{
+}
+
+DepthBuffer::DepthBuffer(int w, int h, Format format_, float zNear_, float zFar_)
+    :data(nullptr), width(0), height(0), pitch(0), capacity(0), format(format_), zNear(zNear_), zFar(zFar_)
+{
+    float maxval = format == UNORM16 ? 65534.f : 16777214.f;
+    scale = maxval / (zFar - zNear);
+    resize(w, h);
+    clear();
+}
+
+DepthBuffer::~DepthBuffer()
+{
+    free(data);
+}
+
+void DepthBuffer::resize(int w, int h)
+{
+    int perLine = ALIGNMENT / bytesPerElement();
+    width = w;
+    height = h;
+    pitch = (w + perLine - 1) / perLine * perLine;
+
+    // Padding so SIMD loads may run past the last pixel
+    size_t nbytes = (size_t)pitch * height * bytesPerElement() + ALIGNMENT;
+    if (nbytes <= capacity)
+        return;
+
+    free(data);
+    data = (unsigned char *)aligned_alloc(ALIGNMENT, nbytes);
+    capacity = nbytes;
+}
+
+void DepthBuffer::clear()
+{
+    size_t nbytes = (size_t)pitch * height * bytesPerElement();
+    if (!nbytes)
+        return;
+
+    // Farthest value for the format: -max for floats, 0 for the quantized ones
+    uint32_t pattern = 0;
+    if (format == FLOAT32)
+    {
+        float far = -std::numeric_limits<float>::max();
+        memcpy(&pattern, &far, sizeof(pattern));
+    }
+
+#ifdef __SSE2__
+    // Allocation and row pitch are multiples of 64 bytes
+    __m128i v = _mm_set1_epi32(pattern);
+    for (unsigned char *p = data, *end = data + nbytes; p < end; p += 64)
+    {
+        _mm_store_si128((__m128i *)p, v);
+        _mm_store_si128((__m128i *)(p + 16), v);
+        _mm_store_si128((__m128i *)(p + 32), v);
+        _mm_store_si128((__m128i *)(p + 48), v);
+    }
+#else
+    uint32_t *p = (uint32_t *)data;
+    for (size_t i = 0; i < nbytes / 4; i++)
+        p[i] = pattern;
+#endif
+}
+
+float DepthBuffer::get(int x, int y) const
+{
+    switch (format)
+    {
+    case FLOAT32:
+        return ((float *)data)[x + y*pitch];
+    case UNORM16:
+        return zNear + (((uint16_t *)data)[x + y*pitch] - 1) / scale;
+    default:
+        return zNear + (((uint32_t *)data)[x + y*pitch] - 1) / scale;
+    }
+}
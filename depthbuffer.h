@@ -0,0 +1,90 @@
+#ifndef __DEPTHBUFFER_H__
+#define __DEPTHBUFFER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+// Row-major depth buffer in a single aligned allocation, laid out like TGAImage
+// so a scanline walk touches consecutive memory. Larger z is closer to the eye.
+// The quantized formats map [zNear, zFar] onto 16 or 24 bit unsigned integers.
+class DepthBuffer
+{
+    public:
+    enum Format {
+        FLOAT32, UNORM16, UNORM24
+    };
+
+    DepthBuffer();
+    DepthBuffer(int w, int h, Format format_ = FLOAT32, float zNear_ = 0.f, float zFar_ = 255.f);
+    ~DepthBuffer();
+
+    DepthBuffer(const DepthBuffer &) = delete;
+    DepthBuffer & operator =(const DepthBuffer &) = delete;
+
+    // Keeps the allocation if it is already large enough
+    void resize(int w, int h);
+    void clear();
+
+    // Depth test, stores z and returns true if z is closer than the stored value
+    inline bool testAndSet(int x, int y, float z)
+    {
+        switch (format)
+        {
+        case FLOAT32: {
+            float &d = ((float *)data)[x + y*pitch];
+            if (d < z) { d = z; return true; }
+            return false;
+        }
+        case UNORM16: {
+            uint16_t q = quantize(z);
+            uint16_t &d = ((uint16_t *)data)[x + y*pitch];
+            if (d < q) { d = q; return true; }
+            return false;
+        }
+        default: {
+            uint32_t q = quantize(z);
+            uint32_t &d = ((uint32_t *)data)[x + y*pitch];
+            if (d < q) { d = q; return true; }
+            return false;
+        }
+        }
+    }
+
+    // Stored depth converted back to a float
+    float get(int x, int y) const;
+
+    // Direct access to a FLOAT32 scanline
+    inline float *row(int y) { return (float *)data + y*pitch; }
+    inline const float *row(int y) const { return (const float *)data + y*pitch; }
+
+    inline int get_width() const { return width; }
+    inline int get_height() const { return height; }
+    inline int get_pitch() const { return pitch; }
+    inline Format get_format() const { return format; }
+
+    private:
+    unsigned char *data;
+    int width;
+    int height;
+    int pitch;          // elements per row, padded to a 64 byte multiple
+    size_t capacity;    // bytes allocated
+    Format format;
+    float zNear;
+    float zFar;
+    float scale;
+
+    inline uint32_t quantize(float z) const
+    {
+        // 0 is reserved for the cleared state so the nearest clamp still passes
+        float t = (z - zNear) * scale;
+        if (t < 0.f) t = 0.f;
+        float maxval = format == UNORM16 ? 65534.f : 16777214.f;
+        if (t > maxval) t = maxval;
+        return (uint32_t)t + 1;
+    }
+
+    int bytesPerElement() const { return format == UNORM16 ? 2 : 4; }
+};
+
+#endif //__DEPTHBUFFER_H__
@@ -0,0 +1,110 @@
+#include "frameloop.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+typedef std::chrono::steady_clock Clock;
+
+static double msBetween(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+FrameLoop::FrameLoop(Model *model, int width, int height)
+    :image_(width, height, TGAImage::RGB), renderer_(image_, model), writer(nullptr), stats_()
+{
+    encoded.reserve(image_.max_encoded_size());
+}
+
+FrameLoop::~FrameLoop()
+{
+    delete writer;
+}
+
+void FrameLoop::setAsyncWrites(int nbuffers)
+{
+    delete writer;
+    writer = nbuffers > 0 ? new FrameWriter(image_.get_width(), image_.get_height(), image_.get_bytespp(), nbuffers) : nullptr;
+}
+
+FrameLoop::CameraPath FrameLoop::turntable(const Camera &start)
+{
+    return [start](int frame, int nframes) {
+        float angle = 2.f * (float)M_PI * frame / nframes;
+        float c = std::cos(angle), s = std::sin(angle);
+        Vec3f k = start.up;
+        k.normalize();
+        Vec3f v = start.eye - start.center;
+        // Rodrigues' rotation of v around k
+        Camera camera = start;
+        camera.eye = start.center + v*c + cross(k, v)*s + k*((k*v)*(1.f - c));
+        return camera;
+    };
+}
+
+FrameLoop::CameraPath FrameLoop::keyframes(const std::vector<Camera> &keys)
+{
+    return [keys](int frame, int nframes) {
+        if (keys.size() < 2 || nframes < 2)
+            return keys.empty() ? Camera() : keys[0];
+        float t = (float)frame / (nframes - 1) * (keys.size() - 1);
+        int i = std::min((int)t, (int)keys.size() - 2);
+        t -= i;
+        const Camera &a = keys[i], &b = keys[i+1];
+        Camera camera;
+        camera.eye = a.eye + (b.eye - a.eye)*t;
+        camera.center = a.center + (b.center - a.center)*t;
+        camera.up = a.up + (b.up - a.up)*t;
+        camera.distance = a.distance + (b.distance - a.distance)*t;
+        return camera;
+    };
+}
+
+bool FrameLoop::run(const CameraPath &path, int nframes, const char *pattern)
+{
+    char filename[4096];
+    stats_ = Stats();
+    double writerMs = writer ? writer->writeMs() : 0.;
+    double writerWaitMs = writer ? writer->waitMs() : 0.;
+    bool ok = true;
+    auto start = Clock::now();
+    for (int i = 0; i < nframes; i++)
+    {
+        auto frameStart = Clock::now();
+        renderer_.setCamera(path(i, nframes));
+        renderer_.clear();
+        renderer_.drawModel();
+        auto rendered = Clock::now();
+        stats_.renderMs += msBetween(frameStart, rendered);
+
+        if (pattern && writer)
+        {
+            // Hand the finished frame over and keep rendering into a
+            // recycled buffer
+            TGAImage *frame = writer->acquire();
+            frame->swap(image_);
+            writer->submit(frame, pattern, i);
+        }
+        else if (pattern)
+        {
+            snprintf(filename, sizeof(filename), pattern, i);
+            // Rows go out bottom first as drawn, no flip needed
+            if (!image_.encode_tga(encoded, true, true) || !FrameWriter::writeFile(filename, encoded))
+            {
+                std::cerr << "can't write frame " << filename << std::endl;
+                return false;
+            }
+            stats_.writeMs += msBetween(rendered, Clock::now());
+        }
+        stats_.frames++;
+    }
+    if (writer)
+    {
+        ok = writer->flush();
+        stats_.writeMs = writer->writeMs() - writerMs;
+        stats_.waitMs = writer->waitMs() - writerWaitMs;
+    }
+    stats_.totalMs = msBetween(start, Clock::now());
+    return ok;
+}
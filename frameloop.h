@@ -0,0 +1,65 @@
+#ifndef __FRAMELOOP_H__
+#define __FRAMELOOP_H__
+
+#include <vector>
+#include <functional>
+#include "tgaimage.h"
+#include "model.h"
+#include "renderer.h"
+#include "framewriter.h"
+
+// Renders frame sequences of one model along a camera path. The image,
+// depth buffer, shader, file buffers and writer thread live as long as the
+// loop, so once the first frame has sized everything a frame does no heap
+// allocation.
+class FrameLoop
+{
+    public:
+    FrameLoop(Model *model, int width, int height);
+    ~FrameLoop();
+
+    FrameLoop(const FrameLoop &) = delete;
+    FrameLoop & operator =(const FrameLoop &) = delete;
+
+    // For shader, depth mode and other settings that stay the same over
+    // the sequence
+    Renderer &renderer() { return renderer_; }
+    TGAImage &image() { return image_; }
+
+    // Camera of frame i out of nframes
+    typedef std::function<Camera(int frame, int nframes)> CameraPath;
+    // One turn of start.eye around the up axis through start.center
+    static CameraPath turntable(const Camera &start);
+    // Linear interpolation between keys spread evenly over the sequence
+    static CameraPath keyframes(const std::vector<Camera> &keys);
+
+    // Encode and write frames on a background thread while the next ones
+    // render, with nbuffers framebuffers in flight. 0 writes every frame
+    // before rendering the next. Finished frames are swapped out of image(),
+    // so after a run it holds a recycled buffer rather than the last frame.
+    void setAsyncWrites(int nbuffers);
+
+    // Render nframes frames. With a printf pattern such as "frame%04d.tga"
+    // every frame is written to the file named after its index.
+    bool run(const CameraPath &path, int nframes, const char *pattern = nullptr);
+
+    struct Stats
+    {
+        int frames;
+        double renderMs;    // clear and draw, summed over the frames
+        double writeMs;     // encoding and writing the files
+        double waitMs;      // rendering blocked on a full write queue
+        double totalMs;
+        double fps() const { return totalMs > 0. ? frames * 1000. / totalMs : 0.; }
+    };
+    const Stats &stats() const { return stats_; }
+
+    private:
+    TGAImage image_;
+    Renderer renderer_;
+    std::vector<unsigned char> encoded;
+    FrameWriter *writer;
+    Stats stats_;
+};
+
+#endif //__FRAMELOOP_H__
@@ -0,0 +1,113 @@
+#include "framewriter.h"
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+FrameWriter::FrameWriter(int width, int height, int bytespp, int nbuffers)
+    :buffers(std::max(1, nbuffers), TGAImage(width, height, bytespp)), jobs(buffers.size()),
+     head(0), count(0), writing(false), failed(false), quit(false), writeMs_(0.), waitMs_(0.)
+{
+    idle.reserve(buffers.size());
+    for (auto &b : buffers)
+        idle.push_back(&b);
+    encoded.reserve(buffers[0].max_encoded_size());
+    thread = std::thread(&FrameWriter::writerLoop, this);
+}
+
+FrameWriter::~FrameWriter()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+TGAImage *FrameWriter::acquire()
+{
+    auto start = Clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return !idle.empty(); });
+    TGAImage *image = idle.back();
+    idle.pop_back();
+    waitMs_ += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return image;
+}
+
+void FrameWriter::submit(TGAImage *image, const char *pattern, int index)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs[(head + count) % jobs.size()] = Job{image, pattern, index};
+        count++;
+    }
+    changed.notify_all();
+}
+
+bool FrameWriter::flush()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] { return !count && !writing; });
+    bool ok = !failed;
+    failed = false;
+    return ok;
+}
+
+void FrameWriter::writerLoop()
+{
+    char filename[4096];
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        changed.wait(guard, [this] { return count || quit; });
+        if (!count)
+            return;
+        Job job = jobs[head];
+        head = (head + 1) % jobs.size();
+        count--;
+        writing = true;
+        guard.unlock();
+
+        auto start = Clock::now();
+        snprintf(filename, sizeof(filename), job.pattern, job.index);
+        // Rows go out bottom first as drawn, no flip needed
+        bool ok = job.image->encode_tga(encoded, true, true) && writeFile(filename, encoded);
+        if (!ok)
+            std::cerr << "can't write frame " << filename << std::endl;
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        guard.lock();
+        writeMs_ += ms;
+        failed = failed || !ok;
+        idle.push_back(job.image);
+        writing = false;
+        changed.notify_all();
+    }
+}
+
+// An ofstream would allocate its buffer for every file
+bool FrameWriter::writeFile(const char *filename, const std::vector<unsigned char> &bytes)
+{
+    int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < bytes.size())
+    {
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        done += n;
+    }
+    return ::close(fd) == 0;
+}
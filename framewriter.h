@@ -0,0 +1,67 @@
+#ifndef __FRAMEWRITER_H__
+#define __FRAMEWRITER_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tgaimage.h"
+
+// Background TGA output for frame sequences. A fixed set of framebuffers
+// cycles between the caller, who fills one and submits it, and a writer
+// thread that RLE encodes and writes it and hands it back. With all of them
+// queued acquire() blocks, which bounds the memory in flight. Nothing is
+// allocated after construction.
+class FrameWriter
+{
+    public:
+    FrameWriter(int width, int height, int bytespp, int nbuffers = 3);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter & operator =(const FrameWriter &) = delete;
+
+    // A framebuffer that is not queued, blocks until one is written
+    TGAImage *acquire();
+    // Write image to the file printf(pattern, index) names. pattern has to
+    // stay valid until flush(). image is recycled once written.
+    void submit(TGAImage *image, const char *pattern, int index);
+    // Wait until everything submitted is on disk, false if a write failed
+    // since the last flush
+    bool flush();
+
+    // Writer thread busy time and caller time spent blocked in acquire,
+    // since construction
+    double writeMs() const { return writeMs_; }
+    double waitMs() const { return waitMs_; }
+
+    // Single write(2) of a whole buffer
+    static bool writeFile(const char *filename, const std::vector<unsigned char> &bytes);
+
+    private:
+    struct Job
+    {
+        TGAImage *image;
+        const char *pattern;
+        int index;
+    };
+
+    std::vector<TGAImage> buffers;
+    std::vector<TGAImage*> idle;
+    // Ring of submitted jobs, never more than there are buffers
+    std::vector<Job> jobs;
+    int head, count;
+    bool writing;
+    bool failed;
+    bool quit;
+    double writeMs_, waitMs_;
+    std::vector<unsigned char> encoded;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void writerLoop();
+};
+
+#endif //__FRAMEWRITER_H__
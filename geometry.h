@@ -4,6 +4,8 @@
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -19,7 +21,7 @@ template <class t> struct Vec2 {
 	inline Vec2<t> operator -(const Vec2<t> &V) const { return Vec2<t>(u-V.u, v-V.v); }
 	inline Vec2<t> operator *(float f)          const { return Vec2<t>(u*f, v*f); }
 	t&             operator [](int i)            { return raw[i]; }
-    //inline t       operator [](int i)            { return raw[i]; }
+	const t&       operator [](int i)      const { return raw[i]; }
 	template <class > friend std::ostream& operator<<(std::ostream& s, Vec2<t>& v);
 };
 
@@ -37,6 +39,7 @@ template <class t> struct Vec3 {
 	inline Vec3<t> operator *(float f)          const { return Vec3<t>(x*f, y*f, z*f); }
    // inline t       operator [](int i)            { return raw[i]; }
     t&             operator [](int i)            { return raw[i]; }
+	const t&       operator [](int i)      const { return raw[i]; }
 	inline t       operator *(const Vec3<t> &v) const { return x*v.x + y*v.y + z*v.z; }
 	float norm () const { return std::sqrt(x*x+y*y+z*z); }
 	Vec3<t> & normalize(t l=1) { *this = (*this)*(l/norm()); return *this; }
@@ -62,49 +65,263 @@ template <class t> std::ostream& operator<<(std::ostream& s, Vec3<t>& v) {
 
 
 
-class Matrix
-{
-public:
-	Matrix();
-	Matrix(const int r, const int c);
-	std::vector<float>& operator [](const int i) { return m[i];};
-	
-	Matrix operator*(const Matrix &mat);
-	Vec3f operator*(const Vec3f &v);
-
-	void setCol(int c, float v[]);
-	
-	inline int nrows() {return rows;};
-	inline int ncols() {return cols;};
-
-	Vec3f toVec();
-	Matrix transpose();
-
-	Matrix inverse();
-
-	static Matrix v2m(const Vec3f v, bool homo = true);
-	static Matrix identity(int dimensions = 4);
-	static Matrix camLookAt(Vec3f eye, Vec3f target, Vec3f up);
-	static Matrix viewport(int width, int height, int x, int y);
-	int rows;
-	int cols;
-	
-	std::vector<std::vector<float>> m;
-	
-	void print()
-	{
-		for(int i = 0; i<rows;i++)
-		{
-			for( int j = 0; j <cols; j++)
-			{
-				std::cout << m[i][j] << "  ";
+template <class t> struct Vec4 {
+	union {
+		struct {t x, y, z, w;};
+		t raw[4];
+	};
+	constexpr Vec4() : x(0), y(0), z(0), w(0) {}
+	constexpr Vec4(t _x, t _y, t _z, t _w) : x(_x),y(_y),z(_z),w(_w) {}
+	constexpr Vec4(const Vec3<t> &v, t _w) : x(v.x),y(v.y),z(v.z),w(_w) {}
+	inline Vec4<t> operator +(const Vec4<t> &v) const { return Vec4<t>(x+v.x, y+v.y, z+v.z, w+v.w); }
+	inline Vec4<t> operator -(const Vec4<t> &v) const { return Vec4<t>(x-v.x, y-v.y, z-v.z, w-v.w); }
+	inline Vec4<t> operator *(float f)          const { return Vec4<t>(x*f, y*f, z*f, w*f); }
+	t&             operator [](int i)            { return raw[i]; }
+	const t&       operator [](int i)      const { return raw[i]; }
+	// Back to 3D with the perspective divide
+	inline Vec3<t> proj() const { return Vec3<t>(x, y, z)*(1.f/w); }
+	inline Vec3<t> xyz()  const { return Vec3<t>(x, y, z); }
+};
+
+typedef Vec4<float> Vec4f;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <int N> struct Mat;
+
+// Fixed size square matrix stored on the stack, row major. The operations
+// every size has, Mat<N> adds the ones only one size has.
+template <int N> struct MatBase {
+	float m[N][N];
+
+	constexpr MatBase() : m{} {}
+
+	constexpr float*       operator [](int i)       { return m[i]; }
+	constexpr const float* operator [](int i) const { return m[i]; }
+
+	constexpr Mat<N> operator *(const Mat<N> &b) const {
+		Mat<N> r;
+		for (int i=0; i<N; i++)
+			for (int j=0; j<N; j++) {
+				r.m[i][j] = 0.f;
+				for (int k=0; k<N; k++)
+					r.m[i][j] += m[i][k]*b.m[k][j];
+			}
+		return r;
+	}
+
+	constexpr Mat<N> transpose() const {
+		Mat<N> r;
+		for (int i=0; i<N; i++)
+			for (int j=0; j<N; j++)
+				r.m[j][i] = m[i][j];
+		return r;
+	}
+
+	// Gauss-Jordan elimination on the matrix augmented with the identity
+	constexpr Mat<N> inverse() const {
+		float a[N][2*N] = {};
+		for (int i=0; i<N; i++) {
+			for (int j=0; j<N; j++)
+				a[i][j] = m[i][j];
+			a[i][i+N] = 1.f;
+		}
+		// first pass
+		for (int i=0; i<N-1; i++) {
+			// normalize the first row
+			for (int j=2*N-1; j>=0; j--)
+				a[i][j] /= a[i][i];
+			for (int k=i+1; k<N; k++) {
+				float coeff = a[k][i];
+				for (int j=0; j<2*N; j++)
+					a[k][j] -= a[i][j]*coeff;
+			}
+		}
+		// normalize the last row
+		for (int j=2*N-1; j>=N-1; j--)
+			a[N-1][j] /= a[N-1][N-1];
+		// second pass
+		for (int i=N-1; i>0; i--) {
+			for (int k=i-1; k>=0; k--) {
+				float coeff = a[k][i];
+				for (int j=0; j<2*N; j++)
+					a[k][j] -= a[i][j]*coeff;
 			}
-			std::cout << std::endl;
 		}
-		std::cout << std::endl;
+		Mat<N> r;
+		for (int i=0; i<N; i++)
+			for (int j=0; j<N; j++)
+				r.m[i][j] = a[i][j+N];
+		return r;
+	}
+
+	static constexpr Mat<N> identity() {
+		Mat<N> r;
+		for (int i=0; i<N; i++)
+			r.m[i][i] = 1.f;
+		return r;
+	}
+};
+
+template <int N> struct Mat : MatBase<N> {};
+
+// Homogeneous 3D transforms
+template <> struct Mat<4> : MatBase<4> {
+	static Mat<4> translation(Vec3f t) {
+		Mat<4> r = Mat<4>::identity();
+		for (int i=0; i<3; i++)
+			r.m[i][3] = t[i];
+		return r;
+	}
+
+	static Mat<4> scaling(Vec3f s) {
+		Mat<4> r = Mat<4>::identity();
+		for (int i=0; i<3; i++)
+			r.m[i][i] = s[i];
+		return r;
+	}
+
+	// View matrix looking from eye at target. It is the inverse of the
+	// camera's orientation O and translation T: V = (T O)^-1 = O^-1 T^-1,
+	// O is orthogonal so O^-1 = O^T, and T^-1 translates by -eye.
+	static Mat<4> camLookAt(Vec3f up, Vec3f target, Vec3f eye) {
+		Vec3f zaxis = (eye-target).normalize();
+		Vec3f xaxis = cross(up, zaxis).normalize();
+		Vec3f yaxis = cross(zaxis, xaxis).normalize();
+		Mat<4> Oinv = Mat<4>::identity();
+		Mat<4> Tr   = Mat<4>::identity();
+		for (int i=0; i<3; i++) {
+			Oinv.m[0][i] = xaxis[i];
+			Oinv.m[1][i] = yaxis[i];
+			Oinv.m[2][i] = zaxis[i];
+			Tr.m[i][3] = -eye[i];
+		}
+		return Oinv*Tr;
+	}
+
+	static constexpr Mat<4> viewport(int width, int height, int x, int y) {
+		Mat<4> r = Mat<4>::identity();
+		r.m[0][0] = width/2.f;
+		r.m[1][1] = height/2.f;
+		r.m[2][2] = 100/2.f;
+		r.m[0][3] = x + width/2.f;
+		r.m[1][3] = y + height/2.f;
+		r.m[2][3] = 255/2.f;
+		return r;
+	}
+};
+
+typedef Mat<3> Mat3;
+typedef Mat<4> Mat4;
+
+inline Vec4f operator *(const Mat4 &a, const Vec4f &v) {
+	Vec4f r;
+	for (int i=0; i<4; i++) {
+		r[i] = 0.f;
+		for (int k=0; k<4; k++)
+			r[i] += a.m[i][k]*v[k];
+	}
+	return r;
+}
+
+inline Vec3f operator *(const Mat3 &a, const Vec3f &v) {
+	Vec3f r;
+	for (int i=0; i<3; i++) {
+		r[i] = 0.f;
+		for (int k=0; k<3; k++)
+			r[i] += a.m[i][k]*v[k];
+	}
+	return r;
+}
+
+// Transform a point, with the perspective divide
+inline Vec3f transformPoint(const Mat4 &a, const Vec3f &v) {
+	return (a*Vec4f(v, 1.f)).proj();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Axis aligned bounding box, empty until something is added
+struct AABB {
+	Vec3f min, max;
+	AABB() : min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+	         max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()) {}
+	AABB(const Vec3f &mn, const Vec3f &mx) : min(mn), max(mx) {}
+	bool empty() const { return min.x > max.x; }
+	Vec3f center() const { return (min + max) * .5f; }
+	Vec3f extent() const { return max - min; }
+	void extend(const Vec3f &p) {
+		for (int i=0; i<3; i++) {
+			min[i] = std::min(min[i], p[i]);
+			max[i] = std::max(max[i], p[i]);
+		}
+	}
+	void extend(const AABB &b) {
+		if (b.empty()) return;
+		extend(b.min);
+		extend(b.max);
+	}
+	// Box around the eight corners moved by the affine transform m
+	AABB transformed(const Mat4 &m) const {
+		AABB r;
+		if (empty()) return r;
+		for (int i=0; i<8; i++)
+			r.extend((m*Vec4f(Vec3f(i&1 ? max.x : min.x, i&2 ? max.y : min.y, i&4 ? max.z : min.z), 1.f)).xyz());
+		return r;
+	}
+};
+
+struct BoundingSphere {
+	Vec3f center;
+	float radius;
+	BoundingSphere() : radius(0.f) {}
+	BoundingSphere(const Vec3f &c, float r) : center(c), radius(r) {}
+	// Sphere around this one moved by the affine transform m, scaled by its
+	// largest axis so non uniform scales stay covered
+	BoundingSphere transformed(const Mat4 &m) const {
+		float scale = 0.f;
+		for (int i=0; i<3; i++)
+			scale = std::max(scale, Vec3f(m[0][i], m[1][i], m[2][i]).norm());
+		return BoundingSphere((m*Vec4f(center, 1.f)).xyz(), radius*scale);
 	}
 };
 
-Matrix v2m(Vec3f v);
+// Clip space frustum of a view projection matrix as world space planes,
+// a point p is inside plane i if planes[i].xyz() * p + planes[i].w >= 0
+struct Frustum {
+	enum { NPLANES = 5 };
+	Vec4f planes[NPLANES];
+	// Left, right, bottom and top at +-w, near at w = nearW. There is no far
+	// plane, depth is not clipped.
+	explicit Frustum(const Mat4 &viewProj, float nearW = 1e-3f) {
+		for (int j=0; j<4; j++) {
+			const float w = viewProj[3][j], x = viewProj[0][j], y = viewProj[1][j];
+			planes[0][j] = w + x;
+			planes[1][j] = w - x;
+			planes[2][j] = w + y;
+			planes[3][j] = w - y;
+			planes[4][j] = w;
+		}
+		planes[4].w -= nearW;
+	}
+	// False if the box is completely outside one of the planes
+	bool intersects(const AABB &b) const {
+		for (int i=0; i<NPLANES; i++) {
+			const Vec4f &p = planes[i];
+			// Corner furthest along the plane normal
+			Vec3f v(p.x >= 0.f ? b.max.x : b.min.x, p.y >= 0.f ? b.max.y : b.min.y, p.z >= 0.f ? b.max.z : b.min.z);
+			if (p.xyz()*v + p.w < 0.f) return false;
+		}
+		return true;
+	}
+	bool intersects(const BoundingSphere &s) const {
+		for (int i=0; i<NPLANES; i++) {
+			const Vec4f &p = planes[i];
+			float len = p.xyz().norm();
+			if (p.xyz()*s.center + p.w < -s.radius*len) return false;
+		}
+		return true;
+	}
+};
 
 #endif //__GEOMETRY_H__
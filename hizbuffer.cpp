@@ -0,0 +1,61 @@
+#include "hizbuffer.h"
+#include <algorithm>
+#include <cmath>
+
+HiZBuffer::HiZBuffer()
+    :ntilesX(0), ntilesY(0)
+{
+}
+
+void HiZBuffer::resize(int w, int h)
+{
+    ntilesX = (w + TILE_SIZE - 1) >> TILE_BITS;
+    ntilesY = (h + TILE_SIZE - 1) >> TILE_BITS;
+    minZ.resize(ntilesX * ntilesY);
+    dirty.resize(ntilesX * ntilesY);
+    clear();
+}
+
+void HiZBuffer::clear()
+{
+    std::fill(minZ.begin(), minZ.end(), -std::numeric_limits<float>::max());
+    std::fill(dirty.begin(), dirty.end(), 0);
+}
+
+void HiZBuffer::refresh(int tile, const DepthBuffer &zbuf)
+{
+    int x0 = (tile % ntilesX) << TILE_BITS;
+    int y0 = (tile / ntilesX) << TILE_BITS;
+    int x1 = std::min(x0 + TILE_SIZE, zbuf.get_width());
+    int y1 = std::min(y0 + TILE_SIZE, zbuf.get_height());
+
+    float lo = std::numeric_limits<float>::max();
+    for (int y = y0; y < y1; y++)
+    {
+        const float *row = zbuf.row(y);
+        for (int x = x0; x < x1; x++)
+            lo = std::min(lo, row[x]);
+    }
+    minZ[tile] = lo;
+    dirty[tile] = 0;
+}
+
+bool HiZBuffer::occluded(int tx, int ty, float zmax, const DepthBuffer &zbuf)
+{
+    if (zbuf.get_format() != DepthBuffer::FLOAT32)
+        return false;
+    int tile = tx + ty*ntilesX;
+    if (dirty[tile])
+        refresh(tile, zbuf);
+    // Interpolated depths may round slightly above the largest vertex depth
+    float margin = std::abs(zmax) * 1e-5f + 1e-5f;
+    return minZ[tile] > zmax + margin;
+}
+
+float HiZBuffer::minDepth(int tx, int ty, const DepthBuffer &zbuf)
+{
+    int tile = tx + ty*ntilesX;
+    if (dirty[tile])
+        refresh(tile, zbuf);
+    return minZ[tile];
+}
@@ -0,0 +1,44 @@
+#ifndef __HIZBUFFER_H__
+#define __HIZBUFFER_H__
+
+#include <vector>
+#include <cstdint>
+#include "depthbuffer.h"
+
+// Coarse depth bounds over 8x8 pixel tiles of a DepthBuffer. A tile whose
+// farthest stored depth is in front of everything a triangle covers can be
+// skipped without touching its pixels. Bounds are refreshed lazily: writers
+// mark a tile dirty and the next query rescans its 64 depths. Only FLOAT32
+// depth buffers are supported, with other formats nothing is ever occluded.
+class HiZBuffer
+{
+    public:
+    static const int TILE_BITS = 3;
+    static const int TILE_SIZE = 1 << TILE_BITS;
+
+    HiZBuffer();
+
+    // Matches the tile grid to a w x h depth buffer and clears it
+    void resize(int w, int h);
+    // Every tile empty, nothing is occluded
+    void clear();
+
+    inline int tilesX() const { return ntilesX; }
+    inline int tilesY() const { return ntilesY; }
+
+    // True if no depth up to zmax can pass the depth test in tile (tx, ty)
+    bool occluded(int tx, int ty, float zmax, const DepthBuffer &zbuf);
+    inline void markDirty(int tx, int ty) { dirty[tx + ty*ntilesX] = 1; }
+
+    // Farthest stored depth of a tile, FLOAT32 only
+    float minDepth(int tx, int ty, const DepthBuffer &zbuf);
+
+    private:
+    int ntilesX, ntilesY;
+    std::vector<float> minZ;
+    std::vector<uint8_t> dirty;
+
+    void refresh(int tile, const DepthBuffer &zbuf);
+};
+
+#endif //__HIZBUFFER_H__
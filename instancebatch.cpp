@@ -0,0 +1,115 @@
+#include "instancebatch.h"
+#include <cmath>
+
+void InstanceBatch::load(const Mat4 *transforms, int n)
+{
+    count = std::min(n, (int)WIDTH);
+    for (int lane = 0; lane < WIDTH; lane++)
+    {
+        const Mat4 &m = lane < count ? transforms[lane] : Mat4::identity();
+        for (int e = 0; e < 16; e++)
+            model[e][lane] = m[e/4][e%4];
+    }
+}
+
+int InstanceBatch::cull(const Frustum &frustum, const BoundingSphere &sphere)
+{
+    const Vec3f &c = sphere.center;
+    float cx[WIDTH], cy[WIDTH], cz[WIDTH], radius[WIDTH];
+    bool inside[WIDTH];
+
+    // World space spheres, scaled by the longest basis vector like
+    // BoundingSphere::transformed
+    for (int lane = 0; lane < WIDTH; lane++)
+    {
+        cx[lane] = model[0][lane]*c.x + model[1][lane]*c.y + model[2][lane]*c.z + model[3][lane];
+        cy[lane] = model[4][lane]*c.x + model[5][lane]*c.y + model[6][lane]*c.z + model[7][lane];
+        cz[lane] = model[8][lane]*c.x + model[9][lane]*c.y + model[10][lane]*c.z + model[11][lane];
+        float s = 0.f;
+        for (int j = 0; j < 3; j++)
+            s = std::max(s, model[j][lane]*model[j][lane] + model[4+j][lane]*model[4+j][lane] + model[8+j][lane]*model[8+j][lane]);
+        radius[lane] = sphere.radius * std::sqrt(s);
+        inside[lane] = true;
+    }
+
+    for (int i = 0; i < Frustum::NPLANES; i++)
+    {
+        const Vec4f &p = frustum.planes[i];
+        float len = p.xyz().norm();
+        for (int lane = 0; lane < WIDTH; lane++)
+            inside[lane] = inside[lane] && p.x*cx[lane] + p.y*cy[lane] + p.z*cz[lane] + p.w >= -radius[lane]*len;
+    }
+
+    int n = 0;
+    for (int lane = 0; lane < WIDTH; lane++)
+    {
+        visible[lane] = lane < count && inside[lane];
+        n += visible[lane];
+    }
+    return n;
+}
+
+void InstanceBatch::transform(const Mat4 &viewProj)
+{
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+        {
+            float *r = mvp[i*4+j];
+            for (int lane = 0; lane < WIDTH; lane++)
+                r[lane] = 0.f;
+            for (int k = 0; k < 4; k++)
+                for (int lane = 0; lane < WIDTH; lane++)
+                    r[lane] += viewProj[i][k]*model[k*4+j][lane];
+        }
+
+    // Mat4::inverse's Gauss-Jordan elimination, every step applied to all
+    // lanes at once. There is no pivoting so the lanes never diverge.
+    const int N = 4;
+    float a[N][2*N][WIDTH];
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < 2*N; j++)
+            for (int lane = 0; lane < WIDTH; lane++)
+                a[i][j][lane] = j < N ? mvp[i*4+j][lane] : (j == i+N ? 1.f : 0.f);
+
+    float coeff[WIDTH];
+    for (int i = 0; i < N-1; i++)
+    {
+        for (int j = 2*N-1; j >= 0; j--)
+            for (int lane = 0; lane < WIDTH; lane++)
+                a[i][j][lane] /= a[i][i][lane];
+        for (int k = i+1; k < N; k++)
+        {
+            for (int lane = 0; lane < WIDTH; lane++)
+                coeff[lane] = a[k][i][lane];
+            for (int j = 0; j < 2*N; j++)
+                for (int lane = 0; lane < WIDTH; lane++)
+                    a[k][j][lane] -= a[i][j][lane]*coeff[lane];
+        }
+    }
+    for (int j = 2*N-1; j >= N-1; j--)
+        for (int lane = 0; lane < WIDTH; lane++)
+            a[N-1][j][lane] /= a[N-1][N-1][lane];
+    for (int i = N-1; i > 0; i--)
+        for (int k = i-1; k >= 0; k--)
+        {
+            for (int lane = 0; lane < WIDTH; lane++)
+                coeff[lane] = a[k][i][lane];
+            for (int j = 0; j < 2*N; j++)
+                for (int lane = 0; lane < WIDTH; lane++)
+                    a[k][j][lane] -= a[i][j][lane]*coeff[lane];
+        }
+
+    // Transposed on the way out
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            for (int lane = 0; lane < WIDTH; lane++)
+                mvpInvT[j*4+i][lane] = a[i][j+N][lane];
+}
+
+Mat4 InstanceBatch::get(const float m[16][WIDTH], int lane)
+{
+    Mat4 r;
+    for (int e = 0; e < 16; e++)
+        r[e/4][e%4] = m[e][lane];
+    return r;
+}
@@ -0,0 +1,32 @@
+#ifndef __INSTANCEBATCH_H__
+#define __INSTANCEBATCH_H__
+
+#include "geometry.h"
+
+// Per instance matrices of up to WIDTH instances in structure of arrays
+// layout: element e of every instance's matrix is contiguous, so the loops
+// over lanes compile to vector code. Lanes past count hold the identity.
+struct InstanceBatch
+{
+    static const int WIDTH = 8;
+
+    int count;
+    float model[16][WIDTH];     // object to world
+    float mvp[16][WIDTH];       // viewProj * model
+    float mvpInvT[16][WIDTH];   // inverse transpose of mvp, for normals
+    bool visible[WIDTH];
+
+    // Copy up to WIDTH transforms in
+    void load(const Mat4 *transforms, int n);
+    // Test every lane's bounding sphere against the frustum, returns the
+    // number of visible instances
+    int cull(const Frustum &frustum, const BoundingSphere &sphere);
+    // Fill mvp and mvpInvT. The results are bit identical to Mat4's
+    // operator* and inverse().transpose() on a single matrix.
+    void transform(const Mat4 &viewProj);
+
+    // One lane of model, mvp or mvpInvT as a Mat4
+    static Mat4 get(const float m[16][WIDTH], int lane);
+};
+
+#endif //__INSTANCEBATCH_H__
@@ -44,7 +44,7 @@ void testObjLines(int argc, char** argv)
 
     TGAImage image(width, height, TGAImage::RGB);
     for (int i=0; i<model->nfaces(); i++) {
-        std::vector<int> face = model->face(i);
+        auto face = model->face(i);
         for (int j=0; j<3; j++) {
             Vec3f v0 = model->vert(face[j]);
             Vec3f v1 = model->vert(face[(j+1)%3]);
@@ -0,0 +1,57 @@
+#include "mappedfile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+    :data_(nullptr), size_(0), mtime_(0)
+{
+}
+
+MappedFile::MappedFile(const char *filename)
+    :MappedFile()
+{
+    open(filename);
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char *filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    data_ = (const char *)p;
+    size_ = st.st_size;
+    mtime_ = st.st_mtime;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_)
+        munmap((void *)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    mtime_ = 0;
+}
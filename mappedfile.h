@@ -0,0 +1,32 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <cstddef>
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+    public:
+    MappedFile();
+    MappedFile(const char *filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator =(const MappedFile &) = delete;
+
+    bool open(const char *filename);
+    void close();
+
+    bool is_open() const { return data_ != nullptr; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    // Modification time of the file in seconds
+    long long mtime() const { return mtime_; }
+
+    private:
+    const char *data_;
+    size_t size_;
+    long long mtime_;
+};
+
+#endif //__MAPPEDFILE_H__
@@ -1,117 +1,266 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <unordered_map>
+#include <thread>
+#include <algorithm>
 #include "model.h"
+#include "objloader.h"
+#include "simplify.h"
 
-Model::Model(const char *filename) : verts_(), faces_(), norms_(), uv_(), diffusemap_(), normalmap_(), specularmap_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
-            Vec3f n;
-            for (int i=0;i<3;i++) iss >> n[i];
-            norms_.push_back(n);
-        } else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
-            Vec2f uv;
-            for (int i=0;i<2;i++) iss >> uv[i];
-            uv_.push_back(uv);
-        }  else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(tmp);
-            }
-            faces_.push_back(f);
+struct CornerKey {
+    int v, uv, n;
+    bool operator ==(const CornerKey &k) const { return v == k.v && uv == k.uv && n == k.n; }
+};
+
+struct CornerKeyHash {
+    size_t operator ()(const CornerKey &k) const {
+        return ((size_t)k.v * 73856093u) ^ ((size_t)k.uv * 19349663u) ^ ((size_t)k.n * 83492791u);
+    }
+};
+
+Model::Model(const char *filename, bool meshCache) : positions_(), uvs_(), normals_(), indices_(), lod_(0), diffusemap_(), normalmap_(), tangentmap_(), specularmap_(), filter_(Texture::NEAREST), normalSpace_(OBJECT_SPACE), hasNormalMap_{false, false} {
+    ObjMesh mesh;
+    int nthreads = std::max(1u, std::thread::hardware_concurrency());
+    if (!(meshCache ? loadObjCached(filename, mesh, nthreads) : loadObj(filename, mesh, nthreads))) return;
+
+    for (auto &n : mesh.norms)
+        n.normalize();
+
+    // De-index the OBJ's separate position/uv/normal indices into one index
+    // per unique tuple, fanning polygons into triangles
+    std::unordered_map<CornerKey, uint32_t, CornerKeyHash> ids;
+    ids.reserve(mesh.corners.size());
+    auto vertexFor = [&](const Vec3i &c) {
+        auto it = ids.emplace(CornerKey{c.ivert, c.iuv, c.inorm}, (uint32_t)positions_.size());
+        if (it.second) {
+            positions_.push_back(mesh.verts[c.ivert]);
+            uvs_.push_back(c.iuv >= 0 ? mesh.uvs[c.iuv] : Vec2f());
+            normals_.push_back(c.inorm >= 0 ? mesh.norms[c.inorm] : Vec3f());
+        }
+        return it.first->second;
+    };
+    for (int i=0; i<mesh.nfaces(); i++) {
+        int first = mesh.faceStart[i];
+        int n = mesh.faceStart[i+1] - first;
+        for (int k=1; k+1<n; k++) {
+            indices_.push_back(vertexFor(mesh.corners[first]));
+            indices_.push_back(vertexFor(mesh.corners[first+k]));
+            indices_.push_back(vertexFor(mesh.corners[first+k+1]));
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
-    
-    if (TANGENT_SPACE)
-        load_texture(filename, "_nm_tangent.tga",      normalmap_);
-    else
-        load_texture(filename, "_nm.tga",      normalmap_);
 
+    for (auto &p : positions_)
+        bbox_.extend(p);
+    Vec3f center = bbox_.center();
+    float radius2 = 0.f;
+    for (auto &p : positions_)
+        radius2 = std::max(radius2, (p - center) * (p - center));
+    sphere_ = BoundingSphere(center, std::sqrt(radius2));
+    computeTangents();
+
+    std::cerr << "# v# " << mesh.verts.size() << " f# "  << mesh.nfaces() << " vt# " << mesh.uvs.size() << " vn# " << mesh.norms.size()
+              << " triangles# " << nfaces() << " unique vertices# " << nverts() << std::endl;
+    load_texture(filename, "_diffuse.tga", diffusemap_);
+    hasNormalMap_[OBJECT_SPACE]  = load_texture(filename, "_nm.tga",         normalmap_);
+    hasNormalMap_[TANGENT_SPACE] = load_texture(filename, "_nm_tangent.tga", tangentmap_);
     load_texture(filename, "_spec.tga",    specularmap_);
-    /* 
-    
-    
-    */
+}
+
+// Per vertex tangent frames the way MikkTSpace builds them: every triangle's
+// tangent and bitangent follow its u and v directions, each corner adds them
+// weighted by its angle, and the sums are made orthogonal to the vertex
+// normal. Vertices are unique (vertex, uv, normal) tuples, so uv seams and
+// mirrored halves already have vertices of their own.
+void Model::computeTangents() {
+    std::vector<Vec3f> tan(positions_.size(), Vec3f()), bitan(positions_.size(), Vec3f());
+    for (size_t i=0; i<indices_.size(); i+=3) {
+        const uint32_t *f = &indices_[i];
+        Vec3f e1 = positions_[f[1]] - positions_[f[0]];
+        Vec3f e2 = positions_[f[2]] - positions_[f[0]];
+        Vec2f d1 = uvs_[f[1]] - uvs_[f[0]];
+        Vec2f d2 = uvs_[f[2]] - uvs_[f[0]];
+        float det = d1.x*d2.y - d2.x*d1.y;
+        if (std::abs(det) < 1e-12f)
+            continue;
+        Vec3f t = (e1*d2.y - e2*d1.y) * (1.f/det);
+        Vec3f b = (e2*d1.x - e1*d2.x) * (1.f/det);
+        if (t.norm() == 0.f || b.norm() == 0.f)
+            continue;
+        t.normalize();
+        b.normalize();
+        for (int k=0; k<3; k++) {
+            Vec3f a = positions_[f[(k+1)%3]] - positions_[f[k]];
+            Vec3f c = positions_[f[(k+2)%3]] - positions_[f[k]];
+            float la = a.norm(), lc = c.norm();
+            if (la == 0.f || lc == 0.f)
+                continue;
+            float angle = std::acos(std::min(1.f, std::max(-1.f, a*c / (la*lc))));
+            tan[f[k]] = tan[f[k]] + t*angle;
+            bitan[f[k]] = bitan[f[k]] + b*angle;
+        }
+    }
+
+    tangents_.resize(positions_.size());
+    for (size_t i=0; i<positions_.size(); i++) {
+        Vec3f n = normals_[i];
+        Vec3f t = tan[i] - n*(n*tan[i]);
+        if (t.norm() < 1e-6f) {
+            // No uv gradient, any direction across the normal will do
+            t = cross(std::abs(n.x) < .9f ? Vec3f(1.f, 0.f, 0.f) : Vec3f(0.f, 1.f, 0.f), n);
+            if (t.norm() < 1e-6f)
+                t = Vec3f(1.f, 0.f, 0.f);
+        }
+        t.normalize();
+        float w = cross(n, t)*bitan[i] < 0.f ? -1.f : 1.f;
+        tangents_[i] = Vec4f(t, w);
+    }
+}
+
+bool Model::setNormalMapSpace(NormalMapSpace space) {
+    if (!hasNormalMap_[space])
+        return false;
+    // Keep the maps resolved once loadTextures() resolved them
+    bool loaded = normalMap().loaded();
+    normalSpace_ = space;
+    if (loaded)
+        normalMap().get();
+    return true;
 }
 
 Model::~Model() {}
 
+void Model::generateLods(int nlevels, float ratio) {
+    // In tuple space a uv or normal seam is an open border, so locking the
+    // vertices of edges used by only one triangle keeps seams and real
+    // borders where they are
+    std::unordered_map<uint64_t, int> edges;
+    for (size_t i=0; i<indices_.size(); i+=3)
+        for (int k=0; k<3; k++) {
+            uint64_t a = indices_[i+k], b = indices_[i+(k+1)%3];
+            edges[std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    std::vector<char> locked(positions_.size(), 0);
+    for (auto &e : edges)
+        if (e.second == 1) {
+            locked[e.first >> 32] = 1;
+            locked[e.first & 0xffffffffu] = 1;
+        }
+
+    std::vector<size_t> targets;
+    float n = nfaces(0);
+    for (int i=0; i<nlevels; i++)
+        targets.push_back((size_t)(n *= ratio));
+    simplifyMesh(positions_, indices_, locked, targets, lods_);
+
+    for (size_t i=0; i<lods_.size(); i++)
+        if (lods_[i].size() == (i ? lods_[i-1] : indices_).size()) {
+            lods_.resize(i);
+            break;
+        }
+    lod_ = 0;
+}
+
 int Model::nverts() {
-    return (int)verts_.size();
+    return (int)positions_.size();
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return (int)faces().size()/3;
 }
 
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i=0; i<(int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
+ArrayView<uint32_t> Model::face(int idx) {
+    return ArrayView<uint32_t>(&faces()[idx*3], 3);
 }
 
 Vec3f Model::vert(int i) {
-    return verts_[i];
+    return positions_[i];
 }
 
 Vec3f Model::vert(int iface, int nthvert) {
-    return verts_[faces_[iface][nthvert][0]];
+    return positions_[faces()[iface*3 + nthvert]];
 }
 
-void Model::load_texture(std::string filename, const char *suffix, TGAImage &img) {
+bool Model::load_texture(std::string filename, const char *suffix, TextureCache::Handle &tex) {
     std::string texfile(filename);
     size_t dot = texfile.find_last_of(".");
+    bool ok = false;
     if (dot!=std::string::npos) {
         texfile = texfile.substr(0,dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
+        tex = TextureCache::instance().open(texfile, &ok);
+        std::cerr << "texture file " << texfile << " loading " << (ok ? "ok" : "failed") << std::endl;
     }
+    return ok;
+}
+
+void Model::loadTextures() {
+    diffusemap_.get();
+    normalMap().get();
+    specularmap_.get();
 }
 
 TGAColor Model::diffuse(Vec2f uvf) {
-    Vec2i uv(uvf[0]*diffusemap_.get_width(), uvf[1]*diffusemap_.get_height());
-    return diffusemap_.get(uv[0], uv[1]);
+    return diffusemap_.get().sample(uvf, 0.f, Texture::NEAREST);
 }
 
-Vec3f Model::normal(Vec2f uvf) {
-    Vec2i uv(uvf[0]*normalmap_.get_width(), uvf[1]*normalmap_.get_height());
-    TGAColor c = normalmap_.get(uv[0], uv[1]);
+TGAColor Model::diffuse(Vec2f uvf, const UvGradient &g) {
+    return diffusemap_.get().sample(uvf, diffusemap_.get().lod(g), filter_);
+}
+
+static Vec3f decodeNormal(TGAColor c) {
     Vec3f res;
     for (int i=0; i<3; i++)
         res[2-i] = (float)c[i]/255.f*2.f - 1.f;
     return res;
 }
 
+Vec3f Model::normal(Vec2f uvf) {
+    return decodeNormal(normalMap().get().sample(uvf, 0.f, Texture::NEAREST));
+}
+
+Vec3f Model::normal(Vec2f uvf, const UvGradient &g) {
+    return decodeNormal(normalMap().get().sample(uvf, normalMap().get().lod(g), filter_));
+}
+
 Vec2f Model::uv(int iface, int nthvert) {
-    return uv_[faces_[iface][nthvert][1]];
+    return uvs_[faces()[iface*3 + nthvert]];
 }
 
 float Model::specular(Vec2f uvf) {
-    Vec2i uv(uvf[0]*specularmap_.get_width(), uvf[1]*specularmap_.get_height());
-    return specularmap_.get(uv[0], uv[1])[0]/1.f;
+    return specularmap_.get().sample(uvf, 0.f, Texture::NEAREST)[0]/1.f;
+}
+
+float Model::specular(Vec2f uvf, const UvGradient &g) {
+    return specularmap_.get().sample(uvf, specularmap_.get().lod(g), filter_)[0]/1.f;
+}
+
+Model::TextureLod Model::textureLod(const UvGradient &g) {
+    TextureLod lod;
+    lod.diffuse = diffusemap_.get().lod(g);
+    lod.normal = normalMap().get().lod(g);
+    lod.specular = specularmap_.get().lod(g);
+    return lod;
+}
+
+TGAColor Model::diffuse(Vec2f uvf, const TextureLod &lod) {
+    return diffusemap_.get().sample(uvf, lod.diffuse, filter_);
+}
+
+Vec3f Model::normal(Vec2f uvf, const TextureLod &lod) {
+    return decodeNormal(normalMap().get().sample(uvf, lod.normal, filter_));
+}
+
+float Model::specular(Vec2f uvf, const TextureLod &lod) {
+    return specularmap_.get().sample(uvf, lod.specular, filter_)[0]/1.f;
 }
 
 Vec3f Model::normal(int iface, int nthvert) {
-    int idx = faces_[iface][nthvert][2];
-    return norms_[idx].normalize();
+    return normals_[faces()[iface*3 + nthvert]];
+}
+
+Vec4f Model::tangent(int iface, int nthvert) {
+    return tangents_[faces()[iface*3 + nthvert]];
 }
 
+
+int Model::vertexId(int iface, int nthvert) {
+    return faces()[iface*3 + nthvert];
+}
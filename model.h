@@ -2,33 +2,125 @@
 #define __MODEL_H__
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <cstddef>
 #include "geometry.h"
 #include "tgaimage.h"
-const bool TANGENT_SPACE = false;
+#include "texture.h"
+#include "texturecache.h"
+
+// Non owning view of a contiguous array
+template <class T> struct ArrayView {
+    const T *data_;
+    size_t size_;
+    ArrayView(const T *d, size_t n) : data_(d), size_(n) {}
+    const T &operator [](size_t i) const { return data_[i]; }
+    const T *begin() const { return data_; }
+    const T *end()   const { return data_ + size_; }
+    const T *data()  const { return data_; }
+    size_t size()    const { return size_; }
+};
 
 class Model {
+public:
+    // What the normal map's vectors are relative to: the model's axes
+    // (_nm.tga) or each vertex's tangent frame (_nm_tangent.tga)
+    enum NormalMapSpace {
+        OBJECT_SPACE, TANGENT_SPACE
+    };
 private:
-    std::vector<Vec3f> verts_;
-    std::vector<std::vector<Vec3i> > faces_; // attention, this Vec3i means vertex/uv/normal
-    std::vector<Vec3f> norms_;
-    std::vector<Vec2f> uv_;
-    TGAImage diffusemap_;
-    TGAImage normalmap_;
-    TGAImage specularmap_;
-    void load_texture(std::string filename, const char *suffix, TGAImage &img);
+    // One entry per unique (vertex, uv, normal) tuple of the OBJ
+    std::vector<Vec3f> positions_;
+    std::vector<Vec2f> uvs_;
+    std::vector<Vec3f> normals_;
+    // Unit tangent orthogonal to the normal, w is the handedness of the
+    // bitangent cross(normal, tangent) * w
+    std::vector<Vec4f> tangents_;
+    // Triangle list into the arrays above, n-gons are fanned at load
+    std::vector<uint32_t> indices_;
+    // Simplified triangle lists of LOD 1 and up, same vertex arrays
+    std::vector<std::vector<uint32_t>> lods_;
+    int lod_;
+    const std::vector<uint32_t> &faces() const { return lod_ ? lods_[lod_-1] : indices_; }
+    // Shared through the texture cache, decoded by the first lookup
+    TextureCache::Handle diffusemap_;
+    TextureCache::Handle normalmap_;
+    TextureCache::Handle tangentmap_;
+    TextureCache::Handle specularmap_;
+    Texture::Filter filter_;
+    NormalMapSpace normalSpace_;
+    bool hasNormalMap_[2];
+    AABB bbox_;
+    BoundingSphere sphere_;
+    bool load_texture(std::string filename, const char *suffix, TextureCache::Handle &tex);
+    void computeTangents();
+    TextureCache::Handle &normalMap() { return normalSpace_ == TANGENT_SPACE ? tangentmap_ : normalmap_; }
 public:
-    Model(const char *filename);
+    // meshCache keeps a binary copy of the parsed OBJ next to it for faster reloads
+    Model(const char *filename, bool meshCache = false);
     ~Model();
+    // Vertices are the unique (vertex, uv, normal) tuples, faces are triangles
+    // of the current level of detail
     int nverts();
     int nfaces();
     Vec3f normal(int iface, int nthvert);
     Vec3f normal(Vec2f uv);
+    Vec4f tangent(int iface, int nthvert);
     Vec3f vert(int i);
     Vec3f vert(int iface, int nthvert);
     Vec2f uv(int iface, int nthvert);
     TGAColor diffuse(Vec2f uv);
     float specular(Vec2f uv);
-    std::vector<int> face(int idx);
+    // Filtered lookups, the mip level is chosen from the uv derivatives
+    TGAColor diffuse(Vec2f uv, const UvGradient &g);
+    Vec3f normal(Vec2f uv, const UvGradient &g);
+    float specular(Vec2f uv, const UvGradient &g);
+    // Mip levels of the three maps, constant over a triangle so shaders can
+    // compute them once instead of per lookup
+    struct TextureLod
+    {
+        float diffuse, normal, specular;
+    };
+    TextureLod textureLod(const UvGradient &g);
+    TGAColor diffuse(Vec2f uv, const TextureLod &lod);
+    Vec3f normal(Vec2f uv, const TextureLod &lod);
+    float specular(Vec2f uv, const TextureLod &lod);
+    void setTextureFilter(Texture::Filter filter) { filter_ = filter; }
+    // Which of the model's normal maps the normal lookups read, only
+    // changes if the model has that map. OBJECT_SPACE by default. After
+    // loadTextures() the new map is resolved right away.
+    bool setNormalMapSpace(NormalMapSpace space);
+    NormalMapSpace normalMapSpace() const { return normalSpace_; }
+    // Decode the maps, or take them from the texture cache, now rather than
+    // on the first lookup. Has to be called before looking textures up from
+    // several threads, the Renderer does when it is given the model.
+    void loadTextures();
+    // The three vertex indices of a triangle
+    ArrayView<uint32_t> face(int idx);
+    // Vertex index of a face corner in [0, nverts), corners sharing a
+    // (vertex, uv, normal) tuple share it
+    int vertexId(int iface, int nthvert);
+
+    // Build levels of detail 1..nlevels by quadric error edge collapse, each
+    // with about ratio times the triangles of the one before. Vertices on uv
+    // or normal seams and open borders are kept in place. Levels that could
+    // not be simplified any further are dropped.
+    void generateLods(int nlevels = 4, float ratio = .5f);
+    int nlods() const { return lods_.size() + 1; }
+    // Level whose triangles the face accessors return, 0 is the full mesh
+    void setLod(int lod) { lod_ = std::min(std::max(lod, 0), nlods()-1); }
+    int lod() const { return lod_; }
+    int nfaces(int lod) const { return (lod ? lods_[lod-1] : indices_).size()/3; }
+
+    // Object space bounds of the positions, computed at load
+    const AABB &bounds() const { return bbox_; }
+    const BoundingSphere &boundingSphere() const { return sphere_; }
+
+    ArrayView<Vec3f> positions()  const { return ArrayView<Vec3f>(positions_.data(), positions_.size()); }
+    ArrayView<Vec2f> uvs()        const { return ArrayView<Vec2f>(uvs_.data(), uvs_.size()); }
+    ArrayView<Vec3f> normals()    const { return ArrayView<Vec3f>(normals_.data(), normals_.size()); }
+    ArrayView<Vec4f> tangents()   const { return ArrayView<Vec4f>(tangents_.data(), tangents_.size()); }
+    ArrayView<uint32_t> indices() const { return ArrayView<uint32_t>(indices_.data(), indices_.size()); }
 };
 #endif //__MODEL_H__
 
@@ -0,0 +1,142 @@
+#include "multisamplebuffer.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "raster.h"
+
+static const size_t ALIGNMENT = 64;
+
+// The D3D standard patterns, no two samples share a row or a column
+static const Vec2i PATTERN4[4] = {Vec2i(-2, -6), Vec2i(6, -2), Vec2i(-6, 2), Vec2i(2, 6)};
+static const Vec2i PATTERN8[8] = {Vec2i(1, -3), Vec2i(-1, 3), Vec2i(5, 1), Vec2i(-3, -5),
+                                  Vec2i(-5, 5), Vec2i(-7, -1), Vec2i(3, 7), Vec2i(7, -7)};
+
+MultisampleBuffer::MultisampleBuffer()
+    :depth(nullptr), color(nullptr), width(0), height(0), samples(4), capacity(0)
+{
+}
+
+MultisampleBuffer::~MultisampleBuffer()
+{
+    free(depth);
+    free(color);
+}
+
+const Vec2i *MultisampleBuffer::pattern(int samples)
+{
+    return samples == 8 ? PATTERN8 : PATTERN4;
+}
+
+void MultisampleBuffer::resize(int w, int h, int samples_)
+{
+    width = w;
+    height = h;
+    samples = samples_ == 8 ? 8 : 4;
+
+    // Tent of radius one pixel around the pixel's sample point
+    const Vec2i *offsets = pattern(samples);
+    for (int n = 0; n < 9; n++)
+        for (int s = 0; s < samples; s++)
+        {
+            float dx = n % 3 - 1 + offsets[s].x / (float)SUBPIXEL_ONE;
+            float dy = n / 3 - 1 + offsets[s].y / (float)SUBPIXEL_ONE;
+            tent[n][s] = std::lround(256.f * std::max(0.f, 1.f - std::abs(dx)) * std::max(0.f, 1.f - std::abs(dy)));
+        }
+
+    size_t n = (size_t)w * h * samples;
+    if (n <= capacity)
+        return;
+    size_t nbytes = (n * sizeof(float) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    free(depth);
+    free(color);
+    depth = (float *)aligned_alloc(ALIGNMENT, nbytes);
+    color = (uint32_t *)aligned_alloc(ALIGNMENT, nbytes);
+    capacity = n;
+}
+
+void MultisampleBuffer::clear()
+{
+    size_t n = (size_t)width * height * samples;
+    std::fill(depth, depth + n, -std::numeric_limits<float>::max());
+    memset(color, 0, n * sizeof(uint32_t));
+}
+
+unsigned MultisampleBuffer::testAndSet(int x, int y, unsigned mask, const float *z)
+{
+    float *d = depth + ((size_t)x + (size_t)y*width)*samples;
+    unsigned passed = 0;
+#ifdef __SSE2__
+    const __m128i bits = _mm_set_epi32(8, 4, 2, 1);
+    for (int s = 0; s < samples; s += 4)
+    {
+        __m128 stored = _mm_load_ps(d + s);
+        __m128 v = _mm_loadu_ps(z + s);
+        __m128i lanes = _mm_and_si128(_mm_set1_epi32(mask >> s), bits);
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(stored, v), _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, bits)));
+        _mm_store_ps(d + s, _mm_or_ps(_mm_and_ps(pass, v), _mm_andnot_ps(pass, stored)));
+        passed |= _mm_movemask_ps(pass) << s;
+    }
+#else
+    for (int s = 0; s < samples; s++)
+        if ((mask & (1u << s)) && d[s] < z[s])
+        {
+            d[s] = z[s];
+            passed |= 1u << s;
+        }
+#endif
+    return passed;
+}
+
+void MultisampleBuffer::resolve(TGAImage &img, Vec2i rectMin, Vec2i rectMax, Filter filter) const
+{
+    int bpp = img.get_bytespp();
+    for (int y = rectMin.y; y <= rectMax.y; y++)
+        for (int x = rectMin.x; x <= rectMax.x; x++)
+        {
+            uint32_t v = 0;
+            if (filter == BOX)
+            {
+                // Red/blue and green/alpha pairs summed in parallel, 8
+                // samples of 255 still fit in 16 bits
+                const uint32_t *c = color + ((size_t)x + (size_t)y*width)*samples;
+                uint32_t rb = 0, ga = 0;
+                for (int s = 0; s < samples; s++)
+                {
+                    rb += c[s] & 0x00ff00ff;
+                    ga += (c[s] >> 8) & 0x00ff00ff;
+                }
+                uint32_t half = samples/2 * 0x00010001;
+                int shift = samples == 8 ? 3 : 2;
+                v = (((rb + half) >> shift) & 0x00ff00ff) | ((((ga + half) >> shift) & 0x00ff00ff) << 8);
+            }
+            else
+            {
+                uint32_t sum[4] = {0, 0, 0, 0};
+                uint32_t weight = 0;
+                for (int n = 0; n < 9; n++)
+                {
+                    int nx = x + n % 3 - 1, ny = y + n / 3 - 1;
+                    if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                        continue;
+                    const uint32_t *c = color + ((size_t)nx + (size_t)ny*width)*samples;
+                    for (int s = 0; s < samples; s++)
+                    {
+                        uint32_t w = tent[n][s];
+                        sum[0] += (c[s] & 0xff) * w;
+                        sum[1] += ((c[s] >> 8) & 0xff) * w;
+                        sum[2] += ((c[s] >> 16) & 0xff) * w;
+                        sum[3] += (c[s] >> 24) * w;
+                        weight += w;
+                    }
+                }
+                for (int i = 0; i < 4; i++)
+                    v |= (sum[i] + weight/2) / weight << (8*i);
+            }
+            img.set(x, y, TGAColor(v, bpp));
+        }
+}
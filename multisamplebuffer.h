@@ -0,0 +1,66 @@
+#ifndef __MULTISAMPLEBUFFER_H__
+#define __MULTISAMPLEBUFFER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Depth and colour samples of a multisampled frame. The samples of a pixel
+// are contiguous, 4 or 8 floats of depth and as many BGRA words of colour,
+// so testing a pixel is one or two 4 wide compares and the resolve reads
+// memory in order. Both arrays are 64 byte aligned. Larger z is closer, as
+// in DepthBuffer.
+class MultisampleBuffer
+{
+    public:
+    static const int MAX_SAMPLES = 8;
+
+    enum Filter {
+        BOX,    // average of the pixel's own samples
+        TENT    // samples of the 3x3 neighbourhood weighted by distance
+    };
+
+    MultisampleBuffer();
+    ~MultisampleBuffer();
+
+    MultisampleBuffer(const MultisampleBuffer &) = delete;
+    MultisampleBuffer & operator =(const MultisampleBuffer &) = delete;
+
+    // samples is 4 or 8. Keeps the allocation if it is already large enough.
+    void resize(int w, int h, int samples);
+    // Farthest depth and black everywhere
+    void clear();
+
+    inline int get_width() const { return width; }
+    inline int get_height() const { return height; }
+    inline int get_samples() const { return samples; }
+    // Rotated grid sample positions, in sub pixel units around the pixel's
+    // sample point
+    const Vec2i *offsets() const { return pattern(samples); }
+    static const Vec2i *pattern(int samples);
+
+    // Depth test of the samples in mask against z[0..samples), stores the
+    // depths that pass and returns their mask
+    unsigned testAndSet(int x, int y, unsigned mask, const float *z);
+    inline void store(int x, int y, unsigned mask, uint32_t colour)
+    {
+        uint32_t *c = color + ((size_t)x + (size_t)y*width)*samples;
+        for (int s = 0; s < samples; s++)
+            if (mask & (1u << s))
+                c[s] = colour;
+    }
+
+    // Filter the samples of [rectMin, rectMax] into img
+    void resolve(TGAImage &img, Vec2i rectMin, Vec2i rectMax, Filter filter) const;
+
+    private:
+    float *depth;
+    uint32_t *color;
+    int width, height, samples;
+    size_t capacity;    // samples allocated
+    // Tent weights of each sample of the 3x3 neighbours, in 1/256
+    int tent[9][MAX_SAMPLES];
+};
+
+#endif //__MULTISAMPLEBUFFER_H__
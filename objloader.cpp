@@ -0,0 +1,424 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+#include "objloader.h"
+#include "mappedfile.h"
+
+void ObjMesh::clear()
+{
+    verts.clear();
+    uvs.clear();
+    norms.clear();
+    corners.clear();
+    faceStart.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline void skipBlanks(const char *&p, const char *end)
+{
+    while (p < end && isBlank(*p)) p++;
+}
+
+static inline void skipLine(const char *&p, const char *end)
+{
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+}
+
+static inline bool parseInt(const char *&p, const char *end, int &out)
+{
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    if (p >= end || *p < '0' || *p > '9')
+        return false;
+    int v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v*10 + (*p++ - '0');
+    out = neg ? -v : v;
+    return true;
+}
+
+// Decimal mantissa and exponent are gathered as integers and combined with a
+// single exact power of ten, which is how strtof rounds for all practical inputs
+static inline bool parseFloat(const char *&p, const char *end, float &out)
+{
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (digits < 19) { mantissa = mantissa*10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++;
+        p++;
+        any = true;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (digits < 19) { mantissa = mantissa*10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+            p++;
+            any = true;
+        }
+    }
+    if (!any)
+        return false;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        int e;
+        if (parseInt(q, end, e))
+        {
+            exponent += e;
+            p = q;
+        }
+    }
+
+    double v = (double)mantissa;
+    if (exponent < 0)
+        v = exponent >= -22 ? v / POW10[-exponent] : v * std::pow(10., exponent);
+    else if (exponent > 0)
+        v = exponent <= 22 ? v * POW10[exponent] : v * std::pow(10., exponent);
+    out = (float)(neg ? -v : v);
+    return true;
+}
+
+// Corners using negative (relative) indices are recorded so a parallel chunk
+// can be rebased once the element counts of the previous chunks are known.
+// An index may only refer to elements defined before its face; the ones a
+// chunk can't check itself become the number of vertices, uvs and normals
+// the previous chunks have to provide.
+struct ObjChunk
+{
+    ObjMesh mesh;
+    std::vector<int> relative;  // corner*3 + component
+    int required[3] = {0, 0, 0};
+    bool invalid = false;       // zero index
+};
+
+static inline int resolveIndex(int idx, int count, ObjChunk &chunk, int slot)
+{
+    int &required = chunk.required[slot%3];
+    if (idx > 0)
+    {
+        required = std::max(required, idx - count);
+        return idx - 1;
+    }
+    if (idx == 0)
+        chunk.invalid = true;
+    required = std::max(required, -(count + idx));
+    chunk.relative.push_back(slot);
+    return count + idx;
+}
+
+static void parseChunk(const char *p, const char *end, ObjChunk &chunk)
+{
+    ObjMesh &mesh = chunk.mesh;
+    mesh.faceStart.push_back(0);
+
+    while (p < end)
+    {
+        skipBlanks(p, end);
+        if (p + 1 >= end) break;
+
+        if (p[0] == 'v' && isBlank(p[1]))
+        {
+            p += 2;
+            Vec3f v;
+            for (int i=0; i<3; i++) { skipBlanks(p, end); parseFloat(p, end, v[i]); }
+            mesh.verts.push_back(v);
+        }
+        else if (p[0] == 'v' && p[1] == 't' && p + 2 < end && isBlank(p[2]))
+        {
+            p += 3;
+            Vec2f uv;
+            for (int i=0; i<2; i++) { skipBlanks(p, end); parseFloat(p, end, uv[i]); }
+            mesh.uvs.push_back(uv);
+        }
+        else if (p[0] == 'v' && p[1] == 'n' && p + 2 < end && isBlank(p[2]))
+        {
+            p += 3;
+            Vec3f n;
+            for (int i=0; i<3; i++) { skipBlanks(p, end); parseFloat(p, end, n[i]); }
+            mesh.norms.push_back(n);
+        }
+        else if (p[0] == 'f' && isBlank(p[1]))
+        {
+            p += 2;
+            while (true)
+            {
+                skipBlanks(p, end);
+                int v;
+                if (!parseInt(p, end, v))
+                    break;
+                int slot = mesh.corners.size()*3;
+                Vec3i c(resolveIndex(v, mesh.verts.size(), chunk, slot), -1, -1);
+                if (p < end && *p == '/')
+                {
+                    p++;
+                    int t;
+                    if (parseInt(p, end, t))
+                        c[1] = resolveIndex(t, mesh.uvs.size(), chunk, slot + 1);
+                    if (p < end && *p == '/')
+                    {
+                        p++;
+                        int n;
+                        if (parseInt(p, end, n))
+                            c[2] = resolveIndex(n, mesh.norms.size(), chunk, slot + 2);
+                    }
+                }
+                mesh.corners.push_back(c);
+            }
+            mesh.faceStart.push_back(mesh.corners.size());
+        }
+        skipLine(p, end);
+    }
+}
+
+bool loadObj(const char *filename, ObjMesh &mesh, int nthreads)
+{
+    mesh.clear();
+    MappedFile file(filename);
+    if (!file.is_open())
+        return false;
+
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+
+    // Don't bother splitting small files
+    const size_t minChunk = 1 << 20;
+    nthreads = std::max(1, std::min<int>(nthreads, file.size() / minChunk));
+
+    // Chunk boundaries moved forward to the next line start
+    std::vector<const char *> bounds(nthreads + 1, end);
+    bounds[0] = begin;
+    for (int i = 1; i < nthreads; i++)
+    {
+        const char *p = begin + file.size() * i / nthreads;
+        p = std::max(p, bounds[i-1]);
+        skipLine(p, end);
+        bounds[i] = p;
+    }
+
+    std::vector<ObjChunk> chunks(nthreads);
+    if (nthreads == 1)
+        parseChunk(bounds[0], bounds[1], chunks[0]);
+    else
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nthreads; i++)
+            threads.emplace_back(parseChunk, bounds[i], bounds[i+1], std::ref(chunks[i]));
+        for (auto &t : threads)
+            t.join();
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        if (chunks[i].invalid)
+            return false;
+
+    if (nthreads == 1)
+    {
+        const ObjChunk &chunk = chunks[0];
+        if (chunk.required[0] > 0 || chunk.required[1] > 0 || chunk.required[2] > 0)
+            return false;
+        mesh = std::move(chunks[0].mesh);
+        return true;
+    }
+
+    // Concatenate the chunks, rebasing relative indices on the way
+    int offsets[3] = {0, 0, 0};
+    mesh.faceStart.push_back(0);
+    for (auto &chunk : chunks)
+    {
+        ObjMesh &part = chunk.mesh;
+        int cornerBase = mesh.corners.size();
+        for (int i = 0; i < 3; i++)
+            if (chunk.required[i] > offsets[i])
+            {
+                mesh.clear();
+                return false;
+            }
+        for (int slot : chunk.relative)
+            part.corners[slot/3][slot%3] += offsets[slot%3];
+
+        mesh.verts.insert(mesh.verts.end(), part.verts.begin(), part.verts.end());
+        mesh.uvs.insert(mesh.uvs.end(), part.uvs.begin(), part.uvs.end());
+        mesh.norms.insert(mesh.norms.end(), part.norms.begin(), part.norms.end());
+        mesh.corners.insert(mesh.corners.end(), part.corners.begin(), part.corners.end());
+        for (size_t f = 1; f < part.faceStart.size(); f++)
+            mesh.faceStart.push_back(cornerBase + part.faceStart[f]);
+
+        offsets[0] += part.verts.size();
+        offsets[1] += part.uvs.size();
+        offsets[2] += part.norms.size();
+    }
+    return true;
+}
+
+bool loadObjStream(const char *filename, ObjMesh &mesh)
+{
+    mesh.clear();
+    std::ifstream in;
+    in.open (filename, std::ifstream::in);
+    if (in.fail()) return false;
+    mesh.faceStart.push_back(0);
+    std::string line;
+    while (!in.eof()) {
+        std::getline(in, line);
+        std::istringstream iss(line.c_str());
+        char trash;
+        if (!line.compare(0, 2, "v ")) {
+            iss >> trash;
+            Vec3f v;
+            for (int i=0;i<3;i++) iss >> v[i];
+            mesh.verts.push_back(v);
+        } else if (!line.compare(0, 3, "vn ")) {
+            iss >> trash >> trash;
+            Vec3f n;
+            for (int i=0;i<3;i++) iss >> n[i];
+            mesh.norms.push_back(n);
+        } else if (!line.compare(0, 3, "vt ")) {
+            iss >> trash >> trash;
+            Vec2f uv;
+            for (int i=0;i<2;i++) iss >> uv[i];
+            mesh.uvs.push_back(uv);
+        }  else if (!line.compare(0, 2, "f ")) {
+            Vec3i tmp;
+            iss >> trash;
+            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
+                for (int i=0; i<3; i++) tmp[i]--; // in wavefront obj all indices start at 1, not zero
+                mesh.corners.push_back(tmp);
+            }
+            mesh.faceStart.push_back(mesh.corners.size());
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t nverts, nuvs, nnorms, ncorners, nfaceStart;
+};
+
+static const char CACHE_MAGIC[4] = {'T', 'R', 'M', 'C'};
+static const uint32_t CACHE_VERSION = 1;
+
+static bool sourceStamp(const char *objfile, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(objfile, &st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+template <class T>
+static void append(std::vector<char> &out, const std::vector<T> &v)
+{
+    const char *p = (const char *)v.data();
+    out.insert(out.end(), p, p + v.size()*sizeof(T));
+}
+
+template <class T>
+static const char *extract(const char *p, std::vector<T> &v, size_t n)
+{
+    v.resize(n);
+    memcpy((void *)v.data(), p, n*sizeof(T));
+    return p + n*sizeof(T);
+}
+
+bool writeMeshCache(const char *cachefile, const char *objfile, const ObjMesh &mesh)
+{
+    MeshCacheHeader header;
+    memset((void *)&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    if (!sourceStamp(objfile, header.sourceSize, header.sourceMtime))
+        return false;
+    header.nverts = mesh.verts.size();
+    header.nuvs = mesh.uvs.size();
+    header.nnorms = mesh.norms.size();
+    header.ncorners = mesh.corners.size();
+    header.nfaceStart = mesh.faceStart.size();
+
+    // Assemble the file in memory so it goes out in one write
+    std::vector<char> out((const char *)&header, (const char *)&header + sizeof(header));
+    append(out, mesh.verts);
+    append(out, mesh.uvs);
+    append(out, mesh.norms);
+    append(out, mesh.corners);
+    append(out, mesh.faceStart);
+
+    std::ofstream file(cachefile, std::ios::binary);
+    file.write(out.data(), out.size());
+    return file.good();
+}
+
+bool readMeshCache(const char *cachefile, const char *objfile, ObjMesh &mesh)
+{
+    MappedFile file(cachefile);
+    if (!file.is_open() || file.size() < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    memcpy((void *)&header, file.data(), sizeof(header));
+    uint64_t size;
+    int64_t mtime;
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || header.version != CACHE_VERSION ||
+        !sourceStamp(objfile, size, mtime) || size != header.sourceSize || mtime != header.sourceMtime)
+        return false;
+
+    size_t expected = sizeof(header) + header.nverts*sizeof(Vec3f) + header.nuvs*sizeof(Vec2f) +
+                      header.nnorms*sizeof(Vec3f) + header.ncorners*sizeof(Vec3i) + header.nfaceStart*sizeof(int);
+    if (file.size() != expected)
+        return false;
+
+    const char *p = file.data() + sizeof(header);
+    p = extract(p, mesh.verts, header.nverts);
+    p = extract(p, mesh.uvs, header.nuvs);
+    p = extract(p, mesh.norms, header.nnorms);
+    p = extract(p, mesh.corners, header.ncorners);
+    extract(p, mesh.faceStart, header.nfaceStart);
+    return true;
+}
+
+bool loadObjCached(const char *filename, ObjMesh &mesh, int nthreads)
+{
+    std::string cachefile = std::string(filename) + ".meshcache";
+    if (readMeshCache(cachefile.c_str(), filename, mesh))
+        return true;
+    if (!loadObj(filename, mesh, nthreads))
+        return false;
+    if (!writeMeshCache(cachefile.c_str(), filename, mesh))
+        std::cerr << "can't write mesh cache " << cachefile << std::endl;
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+
+#include <vector>
+#include "geometry.h"
+
+// Wavefront OBJ contents with flat face storage
+struct ObjMesh
+{
+    std::vector<Vec3f> verts;
+    std::vector<Vec2f> uvs;
+    std::vector<Vec3f> norms;
+    // (vertex, uv, normal) indices of every face corner, zero based, -1 if absent
+    std::vector<Vec3i> corners;
+    // Face i owns corners [faceStart[i], faceStart[i+1]), nfaces+1 entries
+    std::vector<int> faceStart;
+
+    int nfaces() const { return faceStart.empty() ? 0 : (int)faceStart.size() - 1; }
+    void clear();
+};
+
+// Memory mapped OBJ parser. With nthreads > 1 the file is split into chunks
+// at line boundaries which are parsed in parallel and concatenated.
+bool loadObj(const char *filename, ObjMesh &mesh, int nthreads = 1);
+
+// The original std::getline/std::istringstream parser, kept as a reference
+// for benchmarks. Only understands v/vt/vn face corners.
+bool loadObjStream(const char *filename, ObjMesh &mesh);
+
+// Binary mesh cache, tagged with the size and modification time of the OBJ
+// it was made from so a stale cache is never read
+bool writeMeshCache(const char *cachefile, const char *objfile, const ObjMesh &mesh);
+bool readMeshCache(const char *cachefile, const char *objfile, ObjMesh &mesh);
+
+// Read filename.meshcache if it is up to date, otherwise parse the OBJ and
+// write the cache for the next run
+bool loadObjCached(const char *filename, ObjMesh &mesh, int nthreads = 1);
+
+#endif //__OBJLOADER_H__
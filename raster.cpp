@@ -0,0 +1,61 @@
+#include "raster.h"
+#include <algorithm>
+
+bool TriangleSetup::setup(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, int margin)
+{
+    // Snap to the sub pixel grid
+    int64_t fx[3], fy[3];
+    for (int i = 0; i < 3; i++)
+    {
+        fx[i] = (int64_t)std::lround(pts[i].x * SUBPIXEL_ONE);
+        fy[i] = (int64_t)std::lround(pts[i].y * SUBPIXEL_ONE);
+    }
+
+    area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+    if (area == 0)
+        return false;
+
+    // Flip clockwise triangles so the inside is always w >= 0
+    int64_t sign = area > 0 ? 1 : -1;
+    area *= sign;
+    invArea = 1.f / area;
+
+    int64_t minx = std::min(fx[0], std::min(fx[1], fx[2]));
+    int64_t miny = std::min(fy[0], std::min(fy[1], fy[2]));
+    int64_t maxx = std::max(fx[0], std::max(fx[1], fx[2]));
+    int64_t maxy = std::max(fy[0], std::max(fy[1], fy[2]));
+
+    // Pixel samples sit on integer coordinates
+    bboxmin.x = std::max<int64_t>(clipMin.x, (minx - margin + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+    bboxmin.y = std::max<int64_t>(clipMin.y, (miny - margin + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+    bboxmax.x = std::min<int64_t>(clipMax.x, (maxx + margin) >> SUBPIXEL_BITS);
+    bboxmax.y = std::min<int64_t>(clipMax.y, (maxy + margin) >> SUBPIXEL_BITS);
+    if (bboxmin.x > bboxmax.x || bboxmin.y > bboxmax.y)
+        return false;
+
+    for (int i = 0; i < 3; i++)
+    {
+        // Edge opposite to vertex i, from a to b
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        int64_t dx = (fx[b] - fx[a]) * sign;
+        int64_t dy = (fy[b] - fy[a]) * sign;
+
+        // w(p) = dx*(p.y - a.y) - dy*(p.x - a.x) with p in sub pixel units
+        bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+        bias[i] = topLeft ? 0 : -1;
+        A[i] = -dy * SUBPIXEL_ONE;
+        B[i] =  dx * SUBPIXEL_ONE;
+        C[i] = dy * fx[a] - dx * fy[a] + bias[i];
+    }
+    return true;
+}
+
+void rasterizeDepthOnly(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf)
+{
+    if (rasterizeDepthOnlySimd(pts, clipMin, clipMax, zbuf))
+        return;
+    rasterize(pts, clipMin, clipMax, [&](int x, int y, const Vec3f &bc) {
+        zbuf.testAndSet(x, y, pts[0].z*bc.x + pts[1].z*bc.y + pts[2].z*bc.z);
+    });
+}
@@ -0,0 +1,168 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <cstdlib>
+#include "geometry.h"
+#include "depthbuffer.h"
+
+// Sub pixel precision of the fixed point vertex positions
+const int SUBPIXEL_BITS = 4;
+const int SUBPIXEL_ONE  = 1 << SUBPIXEL_BITS;
+
+// Per triangle edge function setup. For vertex i the edge function
+// w_i(x, y) = A[i]*x + B[i]*y + C[i] is the doubled area of the triangle
+// formed by the opposite edge and the sample, so w / area are the barycentric
+// coordinates. Edges are oriented so covered samples have w >= 0, C carries
+// the top-left fill rule bias so shared edges are only drawn once.
+struct TriangleSetup
+{
+    int64_t A[3], B[3], C[3];
+    int64_t bias[3];
+    int64_t area;
+    float invArea;
+    Vec2i bboxmin, bboxmax;
+
+    // Returns false if the triangle is degenerate or misses the clip rectangle.
+    // margin, in sub pixel units, widens the box for samples off the pixel.
+    bool setup(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, int margin = 0);
+
+    // Biased edge values at the pixel (x, y), step by A in x and B in y
+    inline void edgesAt(int x, int y, int64_t w[3]) const
+    {
+        for (int i = 0; i < 3; i++)
+            w[i] = A[i]*x + B[i]*y + C[i];
+    }
+};
+
+// Walk the covered pixels of a triangle inside [clipMin, clipMax], calling
+// fragment(x, y, barycentric) for each. The inner loop only adds.
+template <class F>
+void rasterize(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, F &&fragment)
+{
+    TriangleSetup tri;
+    if (!tri.setup(pts, clipMin, clipMax))
+        return;
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        int64_t w0 = row[0], w1 = row[1], w2 = row[2];
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x++)
+        {
+            if ((w0 | w1 | w2) >= 0)
+            {
+                Vec3f bc((w0 - tri.bias[0]) * tri.invArea,
+                         (w1 - tri.bias[1]) * tri.invArea,
+                         (w2 - tri.bias[2]) * tri.invArea);
+                fragment(x, y, bc);
+            }
+            w0 += tri.A[0];
+            w1 += tri.A[1];
+            w2 += tri.A[2];
+        }
+        row[0] += tri.B[0];
+        row[1] += tri.B[1];
+        row[2] += tri.B[2];
+    }
+}
+
+// Multisampled walk. Coverage is tested at nsamples positions around each
+// pixel's sample point, offsets in sub pixel units and at most 32 of them.
+// fragment(x, y, mask, z, bc) gets the covered samples as a bit mask, the
+// depth at every sample, and the barycentrics to shade the pixel at: its
+// own sample point if that is covered, otherwise the first covered sample,
+// so attributes are never extrapolated past the triangle's edges.
+template <class F>
+void rasterizeMultisample(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, const Vec2i *offsets, int nsamples, F &&fragment)
+{
+    int margin = 0;
+    for (int s = 0; s < nsamples; s++)
+        margin = std::max(margin, std::max(std::abs(offsets[s].x), std::abs(offsets[s].y)));
+    TriangleSetup tri;
+    if (!tri.setup(pts, clipMin, clipMax, margin))
+        return;
+
+    // Edge and depth steps from the pixel's sample point to each sample,
+    // exact since A and B are multiples of SUBPIXEL_ONE
+    int64_t delta[3][32];
+    float dz[32];
+    float zA = pts[0].z*tri.A[0] + pts[1].z*tri.A[1] + pts[2].z*tri.A[2];
+    float zB = pts[0].z*tri.B[0] + pts[1].z*tri.B[1] + pts[2].z*tri.B[2];
+    for (int s = 0; s < nsamples; s++)
+    {
+        for (int i = 0; i < 3; i++)
+            delta[i][s] = (tri.A[i]*offsets[s].x + tri.B[i]*offsets[s].y) / SUBPIXEL_ONE;
+        dz[s] = (zA*offsets[s].x + zB*offsets[s].y) / SUBPIXEL_ONE * tri.invArea;
+    }
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+    float z[32];
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        int64_t w[3] = {row[0], row[1], row[2]};
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x++)
+        {
+            unsigned mask = 0;
+            for (int s = 0; s < nsamples; s++)
+                mask |= (unsigned)((w[0] + delta[0][s]) >= 0 && (w[1] + delta[1][s]) >= 0 && (w[2] + delta[2][s]) >= 0) << s;
+            if (mask)
+            {
+                int64_t e[3] = {w[0] - tri.bias[0], w[1] - tri.bias[1], w[2] - tri.bias[2]};
+                Vec3f center(e[0] * tri.invArea, e[1] * tri.invArea, e[2] * tri.invArea);
+                float zc = pts[0].z*center.x + pts[1].z*center.y + pts[2].z*center.z;
+                for (int s = 0; s < nsamples; s++)
+                    z[s] = zc + dz[s];
+                Vec3f bc = center;
+                if ((w[0] | w[1] | w[2]) < 0)
+                {
+                    int s = __builtin_ctz(mask);
+                    bc = Vec3f((e[0] + delta[0][s]) * tri.invArea, (e[1] + delta[1][s]) * tri.invArea, (e[2] + delta[2][s]) * tri.invArea);
+                }
+                fragment(x, y, mask, (const float *)z, bc);
+            }
+            w[0] += tri.A[0];
+            w[1] += tri.A[1];
+            w[2] += tri.A[2];
+        }
+        row[0] += tri.B[0];
+        row[1] += tri.B[1];
+        row[2] += tri.B[2];
+    }
+}
+
+typedef void (*FragmentCallback)(void *ctx, int x, int y, const Vec3f &bc);
+
+// Vectorized rasterizer, 8 pixels per step with AVX2 or 4 with SSE2 picked at
+// runtime. Coverage, barycentrics and the depth test against a FLOAT32 depth
+// buffer are evaluated a row chunk at a time, fragment is called for every
+// pixel that passed the depth test. Returns false without drawing anything if
+// the triangle can't be handled (depth format, 32 bit edge overflow), the
+// caller then falls back to rasterize().
+bool rasterizeDepthTestedSimd(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf,
+                              FragmentCallback fragment, void *ctx);
+
+// Depth only variant for passes that need no colour, such as shadow maps.
+// Depth is stepped along the triangle's plane instead of being interpolated
+// from barycentrics and nothing is called per pixel. Same coverage as
+// rasterize(), depths may differ from it in the last bits.
+bool rasterizeDepthOnlySimd(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf);
+// rasterizeDepthOnlySimd where it applies, the scalar walk otherwise
+void rasterizeDepthOnly(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf);
+
+// "avx2", "sse2" or "none"
+const char *simdBackendName();
+
+template <class F>
+bool rasterizeDepthTestedSimd(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf, F &&fragment)
+{
+    auto call = [](void *ctx, int x, int y, const Vec3f &bc) { (*(typename std::remove_reference<F>::type *)ctx)(x, y, bc); };
+    return rasterizeDepthTestedSimd(pts, clipMin, clipMax, zbuf, call, (void *)&fragment);
+}
+
+#endif //__RASTER_H__
@@ -0,0 +1,397 @@
+#include "raster.h"
+#include <climits>
+#include <cstdlib>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define RASTER_X86
+#endif
+
+// Edge values are stepped in 32 bit lanes, check that every value the kernel
+// can produce (the bounding box widened to whole chunks) fits
+static bool fitsInt32(const TriangleSetup &tri, int lanes)
+{
+    int chunks = (tri.bboxmax.x - tri.bboxmin.x) / lanes + 1;
+    int xs[2] = {tri.bboxmin.x, tri.bboxmin.x + chunks*lanes};
+    int ys[2] = {tri.bboxmin.y, tri.bboxmax.y};
+    for (int i = 0; i < 3; i++)
+    {
+        if (std::abs(tri.A[i]*lanes) > INT_MAX - 1)
+            return false;
+        for (int x : xs)
+            for (int y : ys)
+            {
+                int64_t w = tri.A[i]*x + tri.B[i]*y + tri.C[i];
+                if (w < INT_MIN + 1 || w > INT_MAX - 1)
+                    return false;
+            }
+    }
+    return true;
+}
+
+#ifdef RASTER_X86
+
+__attribute__((target("avx2")))
+static void rasterizeAvx2(const Vec3f *pts, const TriangleSetup &tri, DepthBuffer &zbuf, FragmentCallback fragment, void *ctx)
+{
+    alignas(32) float b[3][8];
+
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 invArea = _mm256_set1_ps(tri.invArea);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    const __m256i xEnd = _mm256_set1_epi32(tri.bboxmax.x + 1);
+    __m256i offset[3], step[3], bias[3];
+    __m256 z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        offset[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)tri.A[i]));
+        step[i] = _mm256_set1_epi32((int)(tri.A[i]*8));
+        bias[i] = _mm256_set1_epi32((int)tri.bias[i]);
+        z[i] = _mm256_set1_ps(pts[i].z);
+    }
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        float *depth = zbuf.row(y);
+        __m256i w[3];
+        for (int i = 0; i < 3; i++)
+            w[i] = _mm256_add_epi32(_mm256_set1_epi32((int)row[i]), offset[i]);
+
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x += 8)
+        {
+            __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]), minusOne);
+            inside = _mm256_and_si256(inside, _mm256_cmpgt_epi32(xEnd, _mm256_add_epi32(_mm256_set1_epi32(x), lane)));
+
+            if (!_mm256_testz_si256(inside, inside))
+            {
+                __m256 bc[3];
+                for (int i = 0; i < 3; i++)
+                    bc[i] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(w[i], bias[i])), invArea);
+
+                // Same operation order as the scalar path so depths match bit for bit
+                __m256 pz = _mm256_add_ps(_mm256_setzero_ps(), _mm256_mul_ps(z[0], bc[0]));
+                pz = _mm256_add_ps(pz, _mm256_mul_ps(z[1], bc[1]));
+                pz = _mm256_add_ps(pz, _mm256_mul_ps(z[2], bc[2]));
+
+                __m256 d = _mm256_maskload_ps(depth + x, inside);
+                __m256i pass = _mm256_and_si256(inside, _mm256_castps_si256(_mm256_cmp_ps(d, pz, _CMP_LT_OQ)));
+                _mm256_maskstore_ps(depth + x, pass, pz);
+
+                int bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+                if (bits)
+                {
+                    for (int i = 0; i < 3; i++)
+                        _mm256_store_ps(b[i], bc[i]);
+                    for (; bits; bits &= bits - 1)
+                    {
+                        int k = __builtin_ctz(bits);
+                        fragment(ctx, x + k, y, Vec3f(b[0][k], b[1][k], b[2][k]));
+                    }
+                }
+            }
+
+            for (int i = 0; i < 3; i++)
+                w[i] = _mm256_add_epi32(w[i], step[i]);
+        }
+
+        for (int i = 0; i < 3; i++)
+            row[i] += tri.B[i];
+    }
+}
+
+// Depths at x..x+3, reading nothing past last. In tiled mode the pixels
+// after last belong to the neighbouring tile, which another thread may be
+// writing. Lanes past last come back as 0, the inside mask drops them.
+static inline __m128 loadDepthSse2(const float *depth, int x, int last)
+{
+    if (x + 3 <= last)
+        return _mm_loadu_ps(depth + x);
+    alignas(16) float d[4] = {0.f, 0.f, 0.f, 0.f};
+    for (int k = 0; x + k <= last; k++)
+        d[k] = depth[x + k];
+    return _mm_load_ps(d);
+}
+
+static void rasterizeSse2(const Vec3f *pts, const TriangleSetup &tri, DepthBuffer &zbuf, FragmentCallback fragment, void *ctx)
+{
+    alignas(16) float b[3][4];
+    alignas(16) float zs[4];
+
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 invArea = _mm_set1_ps(tri.invArea);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128i xEnd = _mm_set1_epi32(tri.bboxmax.x + 1);
+    __m128i offset[3], step[3], bias[3];
+    __m128 z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int a = (int)tri.A[i];
+        offset[i] = _mm_setr_epi32(0, a, 2*a, 3*a);
+        step[i] = _mm_set1_epi32(4*a);
+        bias[i] = _mm_set1_epi32((int)tri.bias[i]);
+        z[i] = _mm_set1_ps(pts[i].z);
+    }
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        float *depth = zbuf.row(y);
+        __m128i w[3];
+        for (int i = 0; i < 3; i++)
+            w[i] = _mm_add_epi32(_mm_set1_epi32((int)row[i]), offset[i]);
+
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x += 4)
+        {
+            __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]), minusOne);
+            inside = _mm_and_si128(inside, _mm_cmpgt_epi32(xEnd, _mm_add_epi32(_mm_set1_epi32(x), lane)));
+
+            if (_mm_movemask_epi8(inside))
+            {
+                __m128 bc[3];
+                for (int i = 0; i < 3; i++)
+                    bc[i] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(w[i], bias[i])), invArea);
+
+                __m128 pz = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(z[0], bc[0]));
+                pz = _mm_add_ps(pz, _mm_mul_ps(z[1], bc[1]));
+                pz = _mm_add_ps(pz, _mm_mul_ps(z[2], bc[2]));
+
+                // SSE2 has no masked store so passing lanes are written one by one
+                __m128 d = loadDepthSse2(depth, x, tri.bboxmax.x);
+                __m128i pass = _mm_and_si128(inside, _mm_castps_si128(_mm_cmplt_ps(d, pz)));
+
+                int bits = _mm_movemask_ps(_mm_castsi128_ps(pass));
+                if (bits)
+                {
+                    _mm_store_ps(zs, pz);
+                    for (int i = 0; i < 3; i++)
+                        _mm_store_ps(b[i], bc[i]);
+                    for (; bits; bits &= bits - 1)
+                    {
+                        int k = __builtin_ctz(bits);
+                        depth[x + k] = zs[k];
+                        fragment(ctx, x + k, y, Vec3f(b[0][k], b[1][k], b[2][k]));
+                    }
+                }
+            }
+
+            for (int i = 0; i < 3; i++)
+                w[i] = _mm_add_epi32(w[i], step[i]);
+        }
+
+        for (int i = 0; i < 3; i++)
+            row[i] += tri.B[i];
+    }
+}
+
+// Depth of a triangle as a plane over the pixel grid, z at the bounding
+// box's top left pixel and its steps in x and y
+struct DepthPlane
+{
+    float z0, dx, dy;
+
+    DepthPlane(const Vec3f *pts, const TriangleSetup &tri)
+    {
+        int64_t row[3];
+        tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+        double z = 0., zx = 0., zy = 0.;
+        for (int i = 0; i < 3; i++)
+        {
+            z  += (double)pts[i].z * (row[i] - tri.bias[i]);
+            zx += (double)pts[i].z * tri.A[i];
+            zy += (double)pts[i].z * tri.B[i];
+        }
+        z0 = z * tri.invArea;
+        dx = zx * tri.invArea;
+        dy = zy * tri.invArea;
+    }
+};
+
+__attribute__((target("avx2")))
+static void depthOnlyAvx2(const DepthPlane &plane, const TriangleSetup &tri, DepthBuffer &zbuf)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    const __m256i xEnd = _mm256_set1_epi32(tri.bboxmax.x + 1);
+    const __m256 zLane = _mm256_mul_ps(_mm256_cvtepi32_ps(lane), _mm256_set1_ps(plane.dx));
+    const __m256 zStep = _mm256_set1_ps(plane.dx * 8);
+    __m256i offset[3], step[3];
+    for (int i = 0; i < 3; i++)
+    {
+        offset[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)tri.A[i]));
+        step[i] = _mm256_set1_epi32((int)(tri.A[i]*8));
+    }
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        float *depth = zbuf.row(y);
+        __m256i w[3];
+        for (int i = 0; i < 3; i++)
+            w[i] = _mm256_add_epi32(_mm256_set1_epi32((int)row[i]), offset[i]);
+        __m256 pz = _mm256_add_ps(_mm256_set1_ps(plane.z0 + plane.dy * (y - tri.bboxmin.y)), zLane);
+
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x += 8)
+        {
+            __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]), minusOne);
+            inside = _mm256_and_si256(inside, _mm256_cmpgt_epi32(xEnd, _mm256_add_epi32(_mm256_set1_epi32(x), lane)));
+
+            if (!_mm256_testz_si256(inside, inside))
+            {
+                __m256 d = _mm256_maskload_ps(depth + x, inside);
+                __m256i pass = _mm256_and_si256(inside, _mm256_castps_si256(_mm256_cmp_ps(d, pz, _CMP_LT_OQ)));
+                _mm256_maskstore_ps(depth + x, pass, pz);
+            }
+
+            for (int i = 0; i < 3; i++)
+                w[i] = _mm256_add_epi32(w[i], step[i]);
+            pz = _mm256_add_ps(pz, zStep);
+        }
+
+        for (int i = 0; i < 3; i++)
+            row[i] += tri.B[i];
+    }
+}
+
+static void depthOnlySse2(const DepthPlane &plane, const TriangleSetup &tri, DepthBuffer &zbuf)
+{
+    alignas(16) float zs[4];
+
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128i xEnd = _mm_set1_epi32(tri.bboxmax.x + 1);
+    const __m128 zLane = _mm_mul_ps(_mm_setr_ps(0.f, 1.f, 2.f, 3.f), _mm_set1_ps(plane.dx));
+    const __m128 zStep = _mm_set1_ps(plane.dx * 4);
+    __m128i offset[3], step[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int a = (int)tri.A[i];
+        offset[i] = _mm_setr_epi32(0, a, 2*a, 3*a);
+        step[i] = _mm_set1_epi32(4*a);
+    }
+
+    int64_t row[3];
+    tri.edgesAt(tri.bboxmin.x, tri.bboxmin.y, row);
+
+    for (int y = tri.bboxmin.y; y <= tri.bboxmax.y; y++)
+    {
+        float *depth = zbuf.row(y);
+        __m128i w[3];
+        for (int i = 0; i < 3; i++)
+            w[i] = _mm_add_epi32(_mm_set1_epi32((int)row[i]), offset[i]);
+        __m128 pz = _mm_add_ps(_mm_set1_ps(plane.z0 + plane.dy * (y - tri.bboxmin.y)), zLane);
+
+        for (int x = tri.bboxmin.x; x <= tri.bboxmax.x; x += 4)
+        {
+            __m128i inside = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]), minusOne);
+            inside = _mm_and_si128(inside, _mm_cmpgt_epi32(xEnd, _mm_add_epi32(_mm_set1_epi32(x), lane)));
+
+            if (_mm_movemask_epi8(inside))
+            {
+                __m128 d = loadDepthSse2(depth, x, tri.bboxmax.x);
+                __m128i pass = _mm_and_si128(inside, _mm_castps_si128(_mm_cmplt_ps(d, pz)));
+                int bits = _mm_movemask_ps(_mm_castsi128_ps(pass));
+                if (bits == 0xf)
+                    _mm_storeu_ps(depth + x, pz);
+                else if (bits)
+                {
+                    _mm_store_ps(zs, pz);
+                    for (; bits; bits &= bits - 1)
+                    {
+                        int k = __builtin_ctz(bits);
+                        depth[x + k] = zs[k];
+                    }
+                }
+            }
+
+            for (int i = 0; i < 3; i++)
+                w[i] = _mm_add_epi32(w[i], step[i]);
+            pz = _mm_add_ps(pz, zStep);
+        }
+
+        for (int i = 0; i < 3; i++)
+            row[i] += tri.B[i];
+    }
+}
+
+typedef void (*Kernel)(const Vec3f *, const TriangleSetup &, DepthBuffer &, FragmentCallback, void *);
+typedef void (*DepthKernel)(const DepthPlane &, const TriangleSetup &, DepthBuffer &);
+
+static Kernel selectKernel(int &lanes, const char *&name)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        lanes = 8;
+        name = "avx2";
+        return rasterizeAvx2;
+    }
+    lanes = 4;
+    name = "sse2";
+    return rasterizeSse2;
+}
+
+static int kernelLanes;
+static const char *kernelName;
+static const Kernel kernel = selectKernel(kernelLanes, kernelName);
+static const DepthKernel depthKernel = kernelLanes == 8 ? depthOnlyAvx2 : depthOnlySse2;
+
+bool rasterizeDepthTestedSimd(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf,
+                              FragmentCallback fragment, void *ctx)
+{
+    if (zbuf.get_format() != DepthBuffer::FLOAT32)
+        return false;
+
+    TriangleSetup tri;
+    if (!tri.setup(pts, clipMin, clipMax))
+        return true;
+    if (!fitsInt32(tri, kernelLanes))
+        return false;
+
+    kernel(pts, tri, zbuf, fragment, ctx);
+    return true;
+}
+
+bool rasterizeDepthOnlySimd(const Vec3f *pts, Vec2i clipMin, Vec2i clipMax, DepthBuffer &zbuf)
+{
+    if (zbuf.get_format() != DepthBuffer::FLOAT32)
+        return false;
+
+    TriangleSetup tri;
+    if (!tri.setup(pts, clipMin, clipMax))
+        return true;
+    if (!fitsInt32(tri, kernelLanes))
+        return false;
+
+    depthKernel(DepthPlane(pts, tri), tri, zbuf);
+    return true;
+}
+
+const char *simdBackendName()
+{
+    return kernelName;
+}
+
+#else
+
+bool rasterizeDepthTestedSimd(const Vec3f *, Vec2i, Vec2i, DepthBuffer &, FragmentCallback, void *)
+{
+    return false;
+}
+
+bool rasterizeDepthOnlySimd(const Vec3f *, Vec2i, Vec2i, DepthBuffer &)
+{
+    return false;
+}
+
+const char *simdBackendName()
+{
+    return "none";
+}
+
+#endif
@@ -1,7 +1,10 @@
 #include "renderer.h"
 #include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <typeinfo>
 #include "shader.h"
+#include "raster.h"
 
 void drawLine(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
 {
@@ -103,209 +106,1041 @@ void drawTriangle(Vec2i* pts, TGAImage &image, TGAColor color)
 }
 
 Renderer::Renderer(TGAImage &image_)
-    :image(image_)
+    :zBuf(image_.get_width(), image_.get_height()), image(image_), model(nullptr), modelMatrix(Mat4::identity()), lodPixelsPerTriangle(0.f), backend(SCALAR), depthMode(EARLY_Z), shadingRate(RATE_1X1), shadingThreshold(16), multisample(1), resolveFilter(MultisampleBuffer::BOX), hierarchicalZ(false), vertexFrames(false), frame(0), stats(), profileFragments(false), tinted(false), cullMode(CULL_NONE), tiled(false), tileSize(64), pool(nullptr)
 {
-    int w = image.get_width();
-    int h = image.get_height();
-    zBuf.resize(h);
-    for (int i = 0;i < h; i++)
-    {
-        zBuf[i].resize(w);
-        for (int j = 0 ; j < w; j++)
-        {
-            zBuf[i][j] = -std::numeric_limits<float>::max();
-        }
-    }
     init();
 }
 
 Renderer::Renderer(TGAImage &image_, Model* model_)
-    :image(image_), model(model_)
+    :zBuf(image_.get_width(), image_.get_height()), image(image_), model(model_), modelMatrix(Mat4::identity()), lodPixelsPerTriangle(0.f), backend(SCALAR), depthMode(EARLY_Z), shadingRate(RATE_1X1), shadingThreshold(16), multisample(1), resolveFilter(MultisampleBuffer::BOX), hierarchicalZ(false), vertexFrames(false), frame(0), stats(), profileFragments(false), tinted(false), cullMode(CULL_NONE), tiled(false), tileSize(64), pool(nullptr)
 {
-    int w = image.get_width();
-    int h = image.get_height();
-    zBuf.resize(h);
-    for (int i = 0;i < h; i++)
+    init();
+}
+
+void Renderer::clear()
+{
+    image.clear();
+    zBuf.clear();
+    hiZ.clear();
+    if (multisample > 1)
+        msaa.clear();
+}
+
+void Renderer::setMultisample(int samples, MultisampleBuffer::Filter filter)
+{
+    multisample = samples > 1 ? samples : 1;
+    resolveFilter = filter;
+    if (multisample > 1)
     {
-        zBuf[i].resize(w);
-        for (int j = 0 ; j < w; j++)
-        {
-            zBuf[i][j] = -std::numeric_limits<float>::max();
-        }
+        msaa.resize(image.get_width(), image.get_height(), multisample);
+        msaa.clear();
     }
-    init();
+}
+
+void Renderer::setHierarchicalZ(bool enabled)
+{
+    hierarchicalZ = enabled;
+    hiZ.clear();
 }
 
 void Renderer::init()
 {
     // Initilize shader
     shader = new TextureModelShader(model, Vec3f(-1.f, -1.f, -1.f));
+    selectShadedTriangle();
+    // Tiles look textures up from the worker threads
+    if (model)
+        model->loadTextures();
 
-    viewport = Matrix::viewport(image.get_width(), image.get_height(), 0, 0);
+    viewport = Mat4::viewport(image.get_width(), image.get_height(), 0, 0);
+    hiZ.resize(image.get_width(), image.get_height());
 
 }
 
 void Renderer::drawTriangle(Vec3f* pts, TGAColor color)
 {
-    Vec2f bboxmin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(image.get_width()-1, image.get_height()-1);
-    for (int i=0; i<3; i++) {
-        for (int j=0; j<2; j++) {
-            (j == 0 ? bboxmin.x :bboxmin.y) = std::max(0.f,        std::min(bboxmin[j], pts[i][j]));
-            (j == 0 ? bboxmax.x :bboxmax.y) = std::min(clamp[j], std::max(bboxmax[j], pts[i][j]));
-        }
+    Vec2i clipMax(image.get_width()-1, image.get_height()-1);
+    rasterize(pts, Vec2i(0, 0), clipMax, [&](int x, int y, const Vec3f &bc_screen) {
+        float z = 0;
+        for (int i=0; i<3; i++) z += pts[i][2]*bc_screen[i];
+
+        if (zBuf.testAndSet(x, y, z))
+            image.set(x, y, color);
+    });
+}
+
+void Renderer::drawTriangle(Vec3f* pts, Vec2f* uvs)
+{
+    Vec2i clipMax(image.get_width()-1, image.get_height()-1);
+    rasterize(pts, Vec2i(0, 0), clipMax, [&](int x, int y, const Vec3f &bc_screen) {
+        float z = 0;
+        for (int i=0; i<3; i++) z += pts[i][2]*bc_screen[i];
+
+        // Diffuse Texturemap Position
+        Vec2f dtp = uvs[0] * bc_screen[0] + uvs[1] * bc_screen[1] + uvs[2] * bc_screen[2];
+
+        if (zBuf.testAndSet(x, y, z))
+            image.set(x, y, model->diffuse(dtp));
+    });
+}
+
+void Renderer::drawTriangle(Vec3f* pts, TGAColor* vCols)
+{
+    Vec2i clipMax(image.get_width()-1, image.get_height()-1);
+    rasterize(pts, Vec2i(0, 0), clipMax, [&](int x, int y, const Vec3f &bc_screen) {
+        float z = 0;
+        for (int i=0; i<3; i++) z += pts[i][2]*bc_screen[i];
+
+        TGAColor col = vCols[0] * bc_screen[0] + vCols[1] * bc_screen[1] + vCols[2] * bc_screen[2];
+
+        if (zBuf.testAndSet(x, y, z))
+            image.set(x, y, col);
+    });
+}
+
+/*
+
+DRAW TRIANGLE WITH FRAG SHADER PASSED IN */
+
+void Renderer::drawTriangle(Vec3f* pts, ModelShader* shader)
+{
+    drawTriangle<ModelShader>(pts, shader, Vec2i(0, 0), Vec2i(image.get_width()-1, image.get_height()-1), stats);
+}
+
+// Qualified calls bind statically, so the shader's code is inlined into the
+// raster loop. ModelShader itself keeps the virtual calls.
+template <class Shader>
+static inline Vec3f loadVertex(Shader *s, int vertIndex, const ShadedVertex &v) { return s->Shader::loadVertex(vertIndex, v); }
+template <class Shader>
+static inline void setScreenTriangle(Shader *s, const Vec3f *pts) { s->Shader::setScreenTriangle(pts); }
+template <class Shader>
+static inline TGAColor fragShader(Shader *s, const Vec3f &bc) { return s->Shader::fragShader(bc); }
+template <>
+inline Vec3f loadVertex(ModelShader *s, int vertIndex, const ShadedVertex &v) { return s->loadVertex(vertIndex, v); }
+template <>
+inline void setScreenTriangle(ModelShader *s, const Vec3f *pts) { s->setScreenTriangle(pts); }
+template <>
+inline TGAColor fragShader(ModelShader *s, const Vec3f &bc) { return s->fragShader(bc); }
+template <class Shader>
+static inline void loadFrame(Shader *s, int vertIndex, const VertexFrame &f) { s->Shader::loadFrame(vertIndex, f); }
+template <>
+inline void loadFrame(ModelShader *s, int vertIndex, const VertexFrame &f) { s->loadFrame(vertIndex, f); }
+
+// The triangle's vertices from the post-transform buffer, with their
+// frames if the shader takes them
+template <class Shader>
+inline void Renderer::loadTriangle(Shader* shader, const AssembledTriangle &tri)
+{
+    for (int j=0; j<3; j++)
+        loadVertex(shader, j, postTransform[tri.ids[j]]);
+    if (vertexFrames)
+        for (int j=0; j<3; j++)
+            loadFrame(shader, j, postFrames[tri.ids[j]]);
+}
+
+template <class Shader>
+inline TGAColor Renderer::shadeFragment(Shader* shader, const Vec3f &bc, RenderStats &counters)
+{
+    counters.fragments++;
+    TGAColor col;
+    if (!profileFragments)
+        col = fragShader(shader, bc);
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        col = fragShader(shader, bc);
+        counters.fragmentMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
     }
+    if (tinted)
+        for (int i=0; i<3; i++)
+            col.raw[i] = col.raw[i] * (tint.raw[i] + 1) >> 8;
+    return col;
+}
+
+// Rasterize only the part of the triangle inside [clipMin, clipMax]. shader
+// must be exactly a Shader, not a subclass of it. Returns false if nothing
+// of it got past the hierarchical Z.
+template <class Shader>
+bool Renderer::drawTriangle(Vec3f* pts, ModelShader* shader_, Vec2i clipMin, Vec2i clipMax, RenderStats &counters)
+{
+    Shader *shader = static_cast<Shader*>(shader_);
+    setScreenTriangle(shader, pts);
+
+    if (multisample > 1)
+    {
+        rasterizeMultisample(pts, clipMin, clipMax, msaa.offsets(), msaa.get_samples(),
+                             [&](int x, int y, unsigned mask, const float *z, const Vec3f &bc) {
+            mask = msaa.testAndSet(x, y, mask, z);
+            if (!mask)
+                return;
+            msaa.store(x, y, mask, shadeFragment(shader, bc, counters).val);
+            counters.pixels++;
+        });
+        return true;
+    }
+
+    // The depth test already happened, only shade the pixels that passed
+    auto simdFragment = [&](int x, int y, const Vec3f &bc_screen) {
+        image.set(x, y, shadeFragment(shader, bc_screen, counters));
+        counters.pixels++;
+    };
+
+    bool early = depthMode != LATE_Z;
+    auto fragment = [&](int x, int y, const Vec3f &bc_screen) {
+        float z = 0;
+        for (int i=0; i<3; i++) z += pts[i][2]*bc_screen[i];
 
-    Vec3f P;
-    for (P.x=bboxmin.x; P.x<=bboxmax.x; P.x++) {
-        for (P.y=bboxmin.y; P.y<=bboxmax.y; P.y++) {
-            Vec3f bc_screen  = barycentric(pts[0], pts[1], pts[2], P);
-            if (bc_screen.x<0 || bc_screen.y<0 || bc_screen.z<0) continue;
-            P.z = 0;
-            for (int i=0; i<3; i++) P.z += pts[i][2]*bc_screen[i];
-            
-            
-            if (zBuf[int(P.x)][int(P.y)] < P.z) {
-                zBuf[int(P.x)][int(P.y)] = P.z;
-                image.set(P.x, P.y, color);
+        if (early) {
+            if (zBuf.testAndSet(x, y, z)) {
+                image.set(x, y, shadeFragment(shader, bc_screen, counters));
+                counters.pixels++;
             }
+            return;
         }
-    }
+
+        TGAColor col = shadeFragment(shader, bc_screen, counters);
+
+        if (zBuf.testAndSet(x, y, z)) {
+            image.set(x, y, col);
+            counters.pixels++;
+        }
+    };
+
+    return rasterizeUnoccluded(pts, clipMin, clipMax, counters, [&](Vec2i rectMin, Vec2i rectMax) {
+        if (backend == SIMD && rasterizeDepthTestedSimd(pts, rectMin, rectMax, zBuf, simdFragment))
+            return;
+        rasterize(pts, rectMin, rectMax, fragment);
+    });
 }
 
-void Renderer::drawTriangle(Vec3f* pts, Vec2f* uvs)
+// Calls raster(rectMin, rectMax) for the parts of the triangle's bounding box
+// inside [clipMin, clipMax] that the hierarchical Z can't prove hidden.
+// Returns false if there were none.
+template <class F>
+bool Renderer::rasterizeUnoccluded(const Vec3f* pts, Vec2i clipMin, Vec2i clipMax, RenderStats &counters, F &&raster)
 {
-    int height = image.get_height();
-    int width = image.get_width();
-    Vec2f bboxmin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(width-1, height-1);
-    for (int i=0; i<3; i++) {
-        for (int j=0; j<2; j++) {
-            (j == 0 ? bboxmin.x :bboxmin.y) = std::max(0.f,        std::min(bboxmin[j], pts[i][j]));
-            (j == 0 ? bboxmax.x :bboxmax.y) = std::min(clamp[j], std::max(bboxmax[j], pts[i][j]));
-        }
+    // Tiled workers may only touch HiZ tiles inside their own screen tile
+    if (!hierarchicalZ || (tiled && tileSize % HiZBuffer::TILE_SIZE))
+    {
+        raster(clipMin, clipMax);
+        return true;
     }
 
-    Vec3f P;
-    Vec3f K;
-    Vec2f dtp;
-    for (P.x=bboxmin.x; P.x<=bboxmax.x; P.x++) {
-        for (P.y=bboxmin.y; P.y<=bboxmax.y; P.y++) {
-            Vec3f bc_screen  = barycentric(pts[0], pts[1], pts[2], P);
-            if (bc_screen[0] <0 || bc_screen[1] <0 || bc_screen[2]<0) continue;
-            P.z = 0;
-            for (int i=0; i<3; i++) P.z += pts[i][2]*bc_screen[i];
-            
-            // Diffuse Texturemap Position
-            dtp = uvs[0] * bc_screen[0] + uvs[1] * bc_screen[1] + uvs[2] * bc_screen[2];
-            
-            if (zBuf[int(P.x)][int(P.y)] < P.z) {
-                zBuf[int(P.x)][int(P.y)] = P.z;
-                image.set(P.x, P.y, model->diffuse(dtp));
+    int x0 = std::max(clipMin.x, (int)std::min(pts[0].x, std::min(pts[1].x, pts[2].x)));
+    int y0 = std::max(clipMin.y, (int)std::min(pts[0].y, std::min(pts[1].y, pts[2].y)));
+    int x1 = std::min(clipMax.x, (int)std::max(pts[0].x, std::max(pts[1].x, pts[2].x)));
+    int y1 = std::min(clipMax.y, (int)std::max(pts[0].y, std::max(pts[1].y, pts[2].y)));
+    if (x0 > x1 || y0 > y1)
+        return false;
+    float zmax = std::max(pts[0].z, std::max(pts[1].z, pts[2].z));
+
+    const int bits = HiZBuffer::TILE_BITS;
+    int occluded = 0, ntiles = 0;
+    for (int ty = y0 >> bits; ty <= y1 >> bits; ty++)
+        for (int tx = x0 >> bits; tx <= x1 >> bits; tx++, ntiles++)
+            occluded += hiZ.occluded(tx, ty, zmax, zBuf);
+
+    counters.rejectedTiles += occluded;
+    if (occluded == ntiles)
+    {
+        // The other screen tiles may still draw it, drawTiles counts it
+        if (!tiled)
+            counters.rejectedTriangles++;
+        return false;
+    }
+
+    long written = counters.pixels;
+    if (!occluded)
+    {
+        // Nothing to skip, one pass over the whole box
+        raster(Vec2i(x0, y0), Vec2i(x1, y1));
+        if (counters.pixels != written)
+            for (int ty = y0 >> bits; ty <= y1 >> bits; ty++)
+                for (int tx = x0 >> bits; tx <= x1 >> bits; tx++)
+                    hiZ.markDirty(tx, ty);
+        return true;
+    }
+
+    for (int ty = y0 >> bits; ty <= y1 >> bits; ty++)
+        for (int tx = x0 >> bits; tx <= x1 >> bits; tx++)
+        {
+            if (hiZ.occluded(tx, ty, zmax, zBuf))
+                continue;
+            Vec2i rectMin(std::max(x0, tx << bits), std::max(y0, ty << bits));
+            Vec2i rectMax(std::min(x1, ((tx+1) << bits) - 1), std::min(y1, ((ty+1) << bits) - 1));
+            raster(rectMin, rectMax);
+            if (counters.pixels != written)
+            {
+                hiZ.markDirty(tx, ty);
+                written = counters.pixels;
             }
         }
-    }
+    return true;
 }
 
-void Renderer::drawTriangle(Vec3f* pts, TGAColor* vCols)
+void Renderer::clearVisibility(Vec2i clipMin, Vec2i clipMax)
 {
-    int height = image.get_height();
     int width = image.get_width();
-    Vec2f bboxmin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(width-1, height-1);
-    for (int i=0; i<3; i++) {
-        for (int j=0; j<2; j++) {
-            (j == 0 ? bboxmin.x :bboxmin.y) = std::max(0.f,        std::min(bboxmin[j], pts[i][j]));
-            (j == 0 ? bboxmax.x :bboxmax.y) = std::min(clamp[j], std::max(bboxmax[j], pts[i][j]));
+    for (int y = clipMin.y; y <= clipMax.y; y++)
+        for (int x = clipMin.x; x <= clipMax.x; x++)
+            visibility[x + y*width].triangle = -1;
+}
+
+// Depth only pass of the deferred mode, records the triangle that wins each pixel
+bool Renderer::rasterizeVisibility(int index, Vec3f* pts, Vec2i clipMin, Vec2i clipMax, RenderStats &counters)
+{
+    int width = image.get_width();
+    auto store = [&](int x, int y, const Vec3f &bc_screen) {
+        VisibilitySample &sample = visibility[x + y*width];
+        sample.triangle = index;
+        sample.bc = bc_screen;
+        counters.pixels++;
+    };
+
+    auto fragment = [&](int x, int y, const Vec3f &bc_screen) {
+        float z = 0;
+        for (int i=0; i<3; i++) z += pts[i][2]*bc_screen[i];
+        if (zBuf.testAndSet(x, y, z))
+            store(x, y, bc_screen);
+    };
+
+    return rasterizeUnoccluded(pts, clipMin, clipMax, counters, [&](Vec2i rectMin, Vec2i rectMax) {
+        if (backend == SIMD && rasterizeDepthTestedSimd(pts, rectMin, rectMax, zBuf, store))
+            return;
+        rasterize(pts, rectMin, rectMax, fragment);
+    });
+}
+
+// Shading pass of the deferred mode. The triangle's varyings are only
+// reloaded when the triangle changes along the scanline.
+template <class Shader>
+void Renderer::shadeVisibleSamples(ModelShader* shader_, Vec2i clipMin, Vec2i clipMax, RenderStats &counters)
+{
+    Shader *shader = static_cast<Shader*>(shader_);
+    int width = image.get_width();
+    int current = -1;
+    for (int y = clipMin.y; y <= clipMax.y; y++)
+        for (int x = clipMin.x; x <= clipMax.x; x++)
+        {
+            const VisibilitySample &sample = visibility[x + y*width];
+            if (sample.triangle < 0)
+                continue;
+            if (sample.triangle != current)
+            {
+                const AssembledTriangle &tri = triangles[sample.triangle];
+                loadTriangle(shader, tri);
+                setScreenTriangle(shader, tri.pts);
+                current = sample.triangle;
+            }
+            image.set(x, y, shadeFragment(shader, sample.bc, counters));
         }
-    }
+}
 
-    Vec3f P;
-    Vec3f K;
-    TGAColor col;
-    for (P.x=bboxmin.x; P.x<=bboxmax.x; P.x++) {
-        for (P.y=bboxmin.y; P.y<=bboxmax.y; P.y++) {
-            Vec3f bc_screen  = barycentric(pts[0], pts[1], pts[2], P);
-            if (bc_screen[0] <0 || bc_screen[1] <0 || bc_screen[2]<0) continue;
-            P.z = 0;
-            for (int i=0; i<3; i++) P.z += pts[i][2]*bc_screen[i];
-            
-            // Diffuse Texturemap Position
-            col = vCols[0] * bc_screen[0] + vCols[1] * bc_screen[1] + vCols[2] * bc_screen[2];
-            
-            if (zBuf[int(P.x)][int(P.y)] < P.z) {
-                zBuf[int(P.x)][int(P.y)] = P.z;
-                image.set(P.x, P.y, col);
+// The variable rate pass compares blocks with their neighbours inside
+// regions of this many pixels, so its scratch space fits on the stack.
+// Regions sit on a fixed screen grid, the tiled renderer shades them once
+// every tile's visibility is in, so any tile size gives the serial image.
+static const int COARSE_REGION = 64;
+
+template <class Shader>
+void Renderer::shadeVisibleCoarse(ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters)
+{
+    for (int y = clipMin.y / COARSE_REGION * COARSE_REGION; y <= clipMax.y; y += COARSE_REGION)
+        for (int x = clipMin.x / COARSE_REGION * COARSE_REGION; x <= clipMax.x; x += COARSE_REGION)
+            shadeCoarseRegion(static_cast<Shader*>(shader), Vec2i(std::max(clipMin.x, x), std::max(clipMin.y, y)),
+                              Vec2i(std::min(clipMax.x, x + COARSE_REGION - 1), std::min(clipMax.y, y + COARSE_REGION - 1)), counters);
+}
+
+// Blocks are aligned to clipMin. A first pass shades every covered block
+// once, the second spreads those colours or shades finer where a block's
+// colour stands out against one of its neighbours. Shading is continuous
+// across the inner edges of a mesh, so blocks spanning several triangles are
+// shaded coarsely too, colour breaks at silhouettes and seams show up as
+// contrast.
+template <class Shader>
+void Renderer::shadeCoarseRegion(Shader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters)
+{
+    const int MAX_BLOCKS = COARSE_REGION / RATE_2X2;
+    bool covered[MAX_BLOCKS*MAX_BLOCKS];
+    TGAColor blockColor[MAX_BLOCKS*MAX_BLOCKS];
+
+    int width = image.get_width();
+    int rate = shadingRate;
+    int nx = (clipMax.x - clipMin.x) / rate + 1;
+    int ny = (clipMax.y - clipMin.y) / rate + 1;
+    int current = -1;
+
+    auto shade = [&](const VisibilitySample &sample) {
+        if (sample.triangle != current)
+        {
+            const AssembledTriangle &tri = triangles[sample.triangle];
+            loadTriangle(shader, tri);
+            setScreenTriangle(shader, tri.pts);
+            current = sample.triangle;
+        }
+        return shadeFragment(shader, sample.bc, counters);
+    };
+    // One sample for the block: the centroid of the covered pixels if they
+    // all belong to one triangle, otherwise the covered pixel closest to the
+    // block's centre. False if nothing is covered.
+    auto blockSample = [&](Vec2i lo, Vec2i hi, VisibilitySample &out) {
+        int n = 0, best = 1 << 30;
+        bool single = true;
+        Vec3f bc(0.f, 0.f, 0.f);
+        for (int y = lo.y; y <= hi.y; y++)
+            for (int x = lo.x; x <= hi.x; x++)
+            {
+                const VisibilitySample &sample = visibility[x + y*width];
+                if (sample.triangle < 0)
+                    continue;
+                if (n && sample.triangle != out.triangle)
+                    single = false;
+                int d = std::abs(2*x - lo.x - hi.x) + std::abs(2*y - lo.y - hi.y);
+                if (!n || d < best)
+                {
+                    out = sample;
+                    best = d;
+                }
+                bc = bc + sample.bc;
+                n++;
             }
+        if (n && single)
+            out.bc = bc * (1.f/n);
+        return n > 0;
+    };
+    auto fill = [&](Vec2i lo, Vec2i hi, TGAColor color) {
+        for (int y = lo.y; y <= hi.y; y++)
+            for (int x = lo.x; x <= hi.x; x++)
+                if (visibility[x + y*width].triangle >= 0)
+                    image.set(x, y, color);
+    };
+    auto shadePixels = [&](Vec2i lo, Vec2i hi) {
+        for (int y = lo.y; y <= hi.y; y++)
+            for (int x = lo.x; x <= hi.x; x++)
+            {
+                const VisibilitySample &sample = visibility[x + y*width];
+                if (sample.triangle >= 0)
+                    image.set(x, y, shade(sample));
+            }
+    };
+    // High contrast 4x4 blocks get one sample per 2x2 first
+    auto shadeSubBlocks = [&](Vec2i lo, Vec2i hi) {
+        for (int y = lo.y; y <= hi.y; y += 2)
+            for (int x = lo.x; x <= hi.x; x += 2)
+            {
+                Vec2i subMin(x, y), subMax(std::min(hi.x, x+1), std::min(hi.y, y+1));
+                VisibilitySample sample{-1, Vec3f()};
+                if (blockSample(subMin, subMax, sample))
+                    fill(subMin, subMax, shade(sample));
+            }
+    };
+    auto blockMin = [&](int bx, int by) { return Vec2i(clipMin.x + bx*rate, clipMin.y + by*rate); };
+    auto blockMax = [&](int bx, int by) {
+        return Vec2i(std::min(clipMax.x, clipMin.x + (bx+1)*rate - 1), std::min(clipMax.y, clipMin.y + (by+1)*rate - 1));
+    };
+
+    for (int by = 0; by < ny; by++)
+        for (int bx = 0; bx < nx; bx++)
+        {
+            VisibilitySample sample{-1, Vec3f()};
+            int i = bx + by*MAX_BLOCKS;
+            covered[i] = blockSample(blockMin(bx, by), blockMax(bx, by), sample);
+            if (covered[i])
+                blockColor[i] = shade(sample);
         }
+
+    auto differs = [&](const TGAColor &a, int bx, int by) {
+        if (bx < 0 || by < 0 || bx >= nx || by >= ny || !covered[bx + by*MAX_BLOCKS])
+            return false;
+        const TGAColor &b = blockColor[bx + by*MAX_BLOCKS];
+        for (int i=0; i<3; i++)
+            if (std::abs(a.raw[i] - b.raw[i]) > shadingThreshold)
+                return true;
+        return false;
+    };
+
+    for (int by = 0; by < ny; by++)
+        for (int bx = 0; bx < nx; bx++)
+        {
+            if (!covered[bx + by*MAX_BLOCKS])
+                continue;
+            Vec2i lo = blockMin(bx, by), hi = blockMax(bx, by);
+            const TGAColor &color = blockColor[bx + by*MAX_BLOCKS];
+            if (!differs(color, bx-1, by) && !differs(color, bx+1, by) && !differs(color, bx, by-1) && !differs(color, bx, by+1))
+                fill(lo, hi, color);
+            else if (rate == RATE_4X4)
+                shadeSubBlocks(lo, hi);
+            else
+                shadePixels(lo, hi);
+        }
+}
+
+void Renderer::setTiledRendering(bool enabled, int nthreads, int tileSize_)
+{
+    tiled = enabled;
+    tileSize = tileSize_;
+
+    for (auto s : workerShaders)
+        delete s;
+    workerShaders.clear();
+    delete pool;
+    pool = nullptr;
+
+    if (!tiled)
+        return;
+
+    pool = new ThreadPool(nthreads);
+    for (int i = 0; i < pool->size(); i++)
+        workerShaders.push_back(shader->clone());
+    workerStats.resize(pool->size());
+    workerHidden.resize(pool->size());
+}
+
+void Renderer::setShader(ModelShader *shader_)
+{
+    delete shader;
+    shader = shader_;
+    for (auto &s : workerShaders)
+    {
+        delete s;
+        s = shader->clone();
     }
+    selectShadedTriangle();
 }
 
-/*
+void Renderer::setModel(Model *model_)
+{
+    if (model_ && model_ != model)
+        model_->loadTextures();
+    model = model_;
+    shader->setModel(model);
+    for (auto s : workerShaders)
+        s->setModel(model);
+}
 
-DRAW TRIANGLE WITH FRAG SHADER PASSED IN */
+void Renderer::setModelMatrix(const Mat4 &m)
+{
+    modelMatrix = m;
+    shader->setModelMatrix(m);
+    for (auto s : workerShaders)
+        s->setModelMatrix(m);
+}
 
-void Renderer::drawTriangle(Vec3f* pts, ModelShader* shader)
+void Renderer::setCamera(const Camera &camera)
 {
-    int height = image.get_height();
-    int width = image.get_width();
-    Vec2f bboxmin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(width-1, height-1);
-    for (int i=0; i<3; i++) {
-        for (int j=0; j<2; j++) {
-            (j == 0 ? bboxmin.x :bboxmin.y) = std::max(0.f,        std::min(bboxmin[j], pts[i][j]));
-            (j == 0 ? bboxmax.x :bboxmax.y) = std::min(clamp[j], std::max(bboxmax[j], pts[i][j]));
+    shader->setCamera(camera);
+    for (auto s : workerShaders)
+        s->setCamera(camera);
+}
+
+void Renderer::setShadowMap(const ShadowMap *map)
+{
+    shader->setShadowMap(map);
+    for (auto s : workerShaders)
+        s->setShadowMap(map);
+}
+
+void Renderer::selectShadedTriangle()
+{
+    const std::type_info &type = typeid(*shader);
+    if (type == typeid(TextureModelShader)) {
+        shadedTriangle = &Renderer::drawTriangle<TextureModelShader>;
+        shadeVisible = &Renderer::shadeVisibleSamples<TextureModelShader>;
+        shadeCoarse = &Renderer::shadeVisibleCoarse<TextureModelShader>;
+    } else if (type == typeid(SimpleTextureModelShader)) {
+        shadedTriangle = &Renderer::drawTriangle<SimpleTextureModelShader>;
+        shadeVisible = &Renderer::shadeVisibleSamples<SimpleTextureModelShader>;
+        shadeCoarse = &Renderer::shadeVisibleCoarse<SimpleTextureModelShader>;
+    } else if (type == typeid(SimpleModelShader)) {
+        shadedTriangle = &Renderer::drawTriangle<SimpleModelShader>;
+        shadeVisible = &Renderer::shadeVisibleSamples<SimpleModelShader>;
+        shadeCoarse = &Renderer::shadeVisibleCoarse<SimpleModelShader>;
+    } else {
+        shadedTriangle = &Renderer::drawTriangle<ModelShader>;
+        shadeVisible = &Renderer::shadeVisibleSamples<ModelShader>;
+        shadeCoarse = &Renderer::shadeVisibleCoarse<ModelShader>;
+    }
+}
+
+Renderer::~Renderer()
+{
+    setTiledRendering(false);
+    delete shader;
+}
+
+
+void Renderer::beginVertexFrame()
+{
+    // Stamps start at 0, bumping the frame invalidates every entry at once.
+    // Entries past the unique vertices are the ones clipping made last frame.
+    size_t n = model->nverts();
+    if (postFrame.size() != n)
+        postFrame.assign(n, frame);
+    postTransform.resize(n);
+    postScreen.resize(n);
+    vertexFrames = shader->usesVertexFrame();
+    if (vertexFrames)
+        postFrames.resize(n);
+    frame++;
+    cacheStats.lookups = 0;
+    cacheStats.transforms = 0;
+}
+
+Vec3f Renderer::toScreen(const Vec3f &ndc) const
+{
+    Vec3f v = transformPoint(viewport, ndc);
+    return Vec3f(int(v.x), int(v.y), int(v.z));
+}
+
+int Renderer::fetchVertex(int face, int nthvert)
+{
+    int id = model->vertexId(face, nthvert);
+    cacheStats.lookups++;
+    if (postFrame[id] != frame)
+    {
+        shader->transformVertex(face, nthvert, postTransform[id]);
+        if (vertexFrames)
+            shader->transformFrame(face, nthvert, postFrames[id]);
+        postScreen[id] = toScreen(postTransform[id].position);
+        postFrame[id] = frame;
+        cacheStats.transforms++;
+    }
+    return id;
+}
+
+// Triangles are only clipped against the guard band, a few viewports wide.
+// Inside it the rasterizer's bounding box clamp costs less than new vertices.
+static const float GUARD_BAND = 4.f;
+// Near plane in clip space w, keeps the perspective divide finite
+static const float NEAR_W = 1e-3f;
+
+enum ClipPlane {
+    CLIP_NEAR = 1, CLIP_LEFT = 2, CLIP_RIGHT = 4, CLIP_BOTTOM = 8, CLIP_TOP = 16
+};
+
+// Planes v is outside of, with the x and y planes at +-scale*w
+static inline int outcode(const Vec4f &v, float scale)
+{
+    int code = 0;
+    if (v.w < NEAR_W) code |= CLIP_NEAR;
+    if (v.x < -scale*v.w) code |= CLIP_LEFT;
+    if (v.x >  scale*v.w) code |= CLIP_RIGHT;
+    if (v.y < -scale*v.w) code |= CLIP_BOTTOM;
+    if (v.y >  scale*v.w) code |= CLIP_TOP;
+    return code;
+}
+
+// Signed distance to a clip plane of the guard band, >= 0 inside
+static inline float planeDistance(const Vec4f &v, int plane)
+{
+    switch (plane)
+    {
+    case CLIP_NEAR:   return v.w - NEAR_W;
+    case CLIP_LEFT:   return GUARD_BAND*v.w + v.x;
+    case CLIP_RIGHT:  return GUARD_BAND*v.w - v.x;
+    case CLIP_BOTTOM: return GUARD_BAND*v.w + v.y;
+    default:          return GUARD_BAND*v.w - v.y;
+    }
+}
+
+void Renderer::emitTriangle(int a, int b, int c)
+{
+    AssembledTriangle tri;
+    tri.ids[0] = a;
+    tri.ids[1] = b;
+    tri.ids[2] = c;
+    for (int j=0; j<3; j++)
+        tri.pts[j] = postScreen[tri.ids[j]];
+
+    if (cullMode != CULL_NONE)
+    {
+        // Counter-clockwise on screen, with y up, is front facing
+        Vec3f *p = tri.pts;
+        float area = (p[1].x-p[0].x)*(p[2].y-p[0].y) - (p[2].x-p[0].x)*(p[1].y-p[0].y);
+        if (cullMode == CULL_BACK ? area < 0.f : area > 0.f)
+        {
+            stats.backfaces++;
+            return;
         }
     }
+    triangles.push_back(tri);
+}
 
-    Vec3f P;
-    Vec3f K;
-    TGAColor col;
-    for (P.x=bboxmin.x; P.x<=bboxmax.x; P.x++) {
-        for (P.y=bboxmin.y; P.y<=bboxmax.y; P.y++) {
-            Vec3f bc_screen  = barycentric(pts[0], pts[1], pts[2], P);
-            if (bc_screen[0] <0 || bc_screen[1] <0 || bc_screen[2]<0) continue;
-            P.z = 0;
-            for (int i=0; i<3; i++) P.z += pts[i][2]*bc_screen[i];
-            
-            // Diffuse Texturemap Position
-            col = shader->fragShader(bc_screen);
-            
-            if (zBuf[int(P.x)][int(P.y)] < P.z) {
-                zBuf[int(P.x)][int(P.y)] = P.z;
-                image.set(P.x, P.y, col);
+// Sutherland-Hodgman against the planes in the planes mask. The polygon left
+// over gets new post-transform entries and is fanned into triangles.
+void Renderer::clipTriangle(const int ids[3], int planes)
+{
+    // Every plane adds at most one vertex
+    const int MAX_VERTS = 3 + 5;
+    ShadedVertex bufA[MAX_VERTS], bufB[MAX_VERTS];
+    ShadedVertex *in = bufA, *out = bufB;
+    VertexFrame framesA[MAX_VERTS], framesB[MAX_VERTS];
+    VertexFrame *framesIn = framesA, *framesOut = framesB;
+    int n = 3;
+    for (int j=0; j<3; j++)
+    {
+        in[j] = postTransform[ids[j]];
+        if (vertexFrames)
+            framesIn[j] = postFrames[ids[j]];
+    }
+
+    for (int plane = CLIP_NEAR; plane <= CLIP_TOP; plane <<= 1)
+    {
+        if (!(planes & plane))
+            continue;
+        int m = 0;
+        for (int k = 0; k < n; k++)
+        {
+            const ShadedVertex &cur = in[k];
+            const ShadedVertex &next = in[(k+1) % n];
+            float dc = planeDistance(cur.clip, plane);
+            float dn = planeDistance(next.clip, plane);
+            if (dc >= 0.f)
+            {
+                if (vertexFrames)
+                    framesOut[m] = framesIn[k];
+                out[m++] = cur;
+            }
+            if ((dc >= 0.f) != (dn >= 0.f))
+            {
+                float t = dc / (dc - dn);
+                if (vertexFrames)
+                    framesOut[m] = lerp(framesIn[k], framesIn[(k+1) % n], t);
+                out[m++] = lerp(cur, next, t);
             }
         }
+        std::swap(in, out);
+        std::swap(framesIn, framesOut);
+        n = m;
+        if (n < 3)
+            return;
+    }
+
+    int base = postTransform.size();
+    for (int k = 0; k < n; k++)
+    {
+        postTransform.push_back(in[k]);
+        postScreen.push_back(toScreen(in[k].position));
+        if (vertexFrames)
+            postFrames.push_back(framesIn[k]);
     }
+    for (int k = 1; k+1 < n; k++)
+        emitTriangle(base, base+k, base+k+1);
+}
+
+// Vertex stage and primitive assembly. Fills triangles with everything that
+// can reach the screen, in submission order.
+void Renderer::assembleTriangles()
+{
+    triangles.clear();
+    for (int i=0; i<model->nfaces(); i++)
+    {
+        int ids[3];
+        for (int j=0; j<3; j++)
+            ids[j] = fetchVertex(i, j);
+
+        int codes[3], guard = 0;
+        for (int j=0; j<3; j++)
+        {
+            const Vec4f &v = postTransform[ids[j]].clip;
+            codes[j] = outcode(v, 1.f);
+            guard |= outcode(v, GUARD_BAND);
+        }
 
+        // All corners beyond the same frustum plane
+        if (codes[0] & codes[1] & codes[2])
+        {
+            stats.outside++;
+            continue;
+        }
+        if (guard)
+        {
+            stats.clipped++;
+            clipTriangle(ids, guard);
+            continue;
+        }
+        emitTriangle(ids[0], ids[1], ids[2]);
+    }
+    stats.assembled = triangles.size();
 }
 
+// Screen radius of the bounding sphere from the distance of its center, a
+// sphere reaching behind the camera gets the full mesh
+int Renderer::selectLod() const
+{
+    Mat4 mvp = viewProjection() * modelMatrix;
+    const BoundingSphere &sphere = model->boundingSphere();
+    Vec4f center = mvp * Vec4f(sphere.center, 1.f);
+    float w = center.w - sphere.radius * Vec3f(mvp[3][0], mvp[3][1], mvp[3][2]).norm();
+    if (w <= 0.f)
+        return 0;
+
+    float scale = std::max(Vec3f(mvp[0][0], mvp[0][1], mvp[0][2]).norm() * image.get_width(),
+                           Vec3f(mvp[1][0], mvp[1][1], mvp[1][2]).norm() * image.get_height()) * .5f;
+    float radius = sphere.radius * scale / center.w;
+    float area = 3.14159265f * radius * radius;
+    for (int lod = 0; lod < model->nlods(); lod++)
+        if (model->nfaces(lod) * lodPixelsPerTriangle <= area)
+            return lod;
+    return model->nlods() - 1;
+}
 
 void Renderer::drawModel()
 {
-    for (int i=0; i<model->nfaces(); i++)
+    stats = RenderStats();
+    int previousLod = model->lod();
+    if (lodPixelsPerTriangle > 0.f)
+        model->setLod(selectLod());
+    stats.triangles = model->nfaces();
+    beginVertexFrame();
+    bool deferred = multisample == 1 && (depthMode == DEFERRED || shadingRate != RATE_1X1);
+    if (deferred)
+        visibility.resize(image.get_width() * image.get_height());
+
+    auto start = std::chrono::steady_clock::now();
+    assembleTriangles();
+    if (tiled)
+        binTriangles();
+    auto mid = std::chrono::steady_clock::now();
+
+    Vec2i clipMax(image.get_width()-1, image.get_height()-1);
+    if (tiled)
+        drawTiles();
+    else if (deferred)
+    {
+        clearVisibility(Vec2i(0, 0), clipMax);
+        for (size_t i=0; i<triangles.size(); i++)
+            rasterizeVisibility(i, triangles[i].pts, Vec2i(0, 0), clipMax, stats);
+        (this->*(shadingRate != RATE_1X1 ? shadeCoarse : shadeVisible))(shader, Vec2i(0, 0), clipMax, stats);
+    }
+    else
+    {
+        for (auto &tri : triangles)
+        {
+            loadTriangle(shader, tri);
+            (this->*shadedTriangle)(tri.pts, shader, Vec2i(0, 0), clipMax, stats);
+        }
+    }
+    if (multisample > 1)
+        resolveMultisample();
+    auto end = std::chrono::steady_clock::now();
+
+    stats.vertexMs = std::chrono::duration<double, std::milli>(mid - start).count();
+    stats.rasterMs = std::chrono::duration<double, std::milli>(end - mid).count();
+    model->setLod(previousLod);
+}
+
+Renderer::RenderStats &Renderer::RenderStats::operator+=(const RenderStats &s)
+{
+    triangles += s.triangles;
+    outside += s.outside;
+    backfaces += s.backfaces;
+    clipped += s.clipped;
+    assembled += s.assembled;
+    fragments += s.fragments;
+    pixels += s.pixels;
+    vertexMs += s.vertexMs;
+    rasterMs += s.rasterMs;
+    fragmentMs += s.fragmentMs;
+    rejectedTriangles += s.rejectedTriangles;
+    rejectedTiles += s.rejectedTiles;
+    instances += s.instances;
+    culledInstances += s.culledInstances;
+    return *this;
+}
+
+// Instances go through in batches of InstanceBatch::WIDTH. The batch culls
+// and builds the matrices for all its lanes together, what is left per
+// visible instance is handing three matrices to the shaders and drawModel.
+void Renderer::drawInstanced(const Mat4 *transforms, int count, const TGAColor *tints)
+{
+    RenderStats total = RenderStats();
+    total.instances = count;
+    Mat4 saved = modelMatrix;
+
+    Mat4 viewProj = shader->viewProjection();
+    Frustum frustum(viewProj);
+    const BoundingSphere &sphere = model->boundingSphere();
+
+    for (int first = 0; first < count; first += InstanceBatch::WIDTH)
+    {
+        auto start = std::chrono::steady_clock::now();
+        InstanceBatch &batch = instanceBatch;
+        batch.load(transforms + first, count - first);
+        int nvisible = batch.cull(frustum, sphere);
+        total.culledInstances += batch.count - nvisible;
+        if (nvisible)
+            batch.transform(viewProj);
+        total.vertexMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (int lane = 0; lane < batch.count; lane++)
+        {
+            if (!batch.visible[lane])
+                continue;
+            Mat4 m = InstanceBatch::get(batch.model, lane);
+            Mat4 mvp = InstanceBatch::get(batch.mvp, lane);
+            Mat4 mvpInvT = InstanceBatch::get(batch.mvpInvT, lane);
+            modelMatrix = m;
+            shader->setModelTransforms(m, mvp, mvpInvT);
+            for (auto s : workerShaders)
+                s->setModelTransforms(m, mvp, mvpInvT);
+            tinted = tints != nullptr;
+            if (tinted)
+                tint = tints[first + lane];
+
+            drawModel();
+            total += stats;
+        }
+    }
+    tinted = false;
+    setModelMatrix(saved);
+    stats = total;
+}
+
+// Resolve the bounding box of this draw's triangles, grown by the sample
+// offsets and the tent's reach. Tiled renderers split it into rows of tiles.
+void Renderer::resolveMultisample()
+{
+    if (triangles.empty())
+        return;
+    float minx = triangles[0].pts[0].x, maxx = minx;
+    float miny = triangles[0].pts[0].y, maxy = miny;
+    for (const AssembledTriangle &tri : triangles)
+        for (int j=0; j<3; j++)
+        {
+            minx = std::min(minx, tri.pts[j].x);
+            maxx = std::max(maxx, tri.pts[j].x);
+            miny = std::min(miny, tri.pts[j].y);
+            maxy = std::max(maxy, tri.pts[j].y);
+        }
+    Vec2i rectMin(std::max(0, (int)std::floor(minx) - 2), std::max(0, (int)std::floor(miny) - 2));
+    Vec2i rectMax(std::min(image.get_width()-1, (int)std::ceil(maxx) + 2), std::min(image.get_height()-1, (int)std::ceil(maxy) + 2));
+    if (rectMin.x > rectMax.x || rectMin.y > rectMax.y)
+        return;
+    if (!tiled)
     {
-        std::vector<int> face = model->face(i);
-        Vec3f screen_coords[3];
-        // Temp
-        Vec3f worldCoords;
-        Vec3f v;
-        TGAColor vCols[3];
-        vCols[0] = red;
-        vCols[1] = green;
-        vCols[2] = blue;
-        //Vec2f uvs[3];
-
-        for (int j=0; j<3; j++) {
-            // Convert to screen coordinates
-            v = (viewport * Matrix::v2m(shader->vertexShader(i, j))).toVec();
-            screen_coords[j] = Vec3f(int(v.x), int(v.y), int(v.z));
+        msaa.resolve(image, rectMin, rectMax, resolveFilter);
+        return;
+    }
+    int rows = (rectMax.y - rectMin.y) / tileSize + 1;
+    pool->run(rows, [&](int, int row) {
+        int y0 = rectMin.y + row*tileSize;
+        msaa.resolve(image, Vec2i(rectMin.x, y0), Vec2i(rectMax.x, std::min(rectMax.y, y0 + tileSize - 1)), resolveFilter);
+    });
+}
+
+// Sort the assembled triangles into the screen tiles their bounding boxes
+// touch, keeping submission order within each bin
+void Renderer::binTriangles()
+{
+    int width = image.get_width();
+    int height = image.get_height();
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+
+    bins.resize(tilesX * tilesY);
+    for (auto &bin : bins)
+        bin.clear();
+
+    // Multisampled pixels are covered up to half a pixel past their centre
+    float margin = multisample > 1 ? .5f : 0.f;
+    for (size_t index=0; index<triangles.size(); index++)
+    {
+        const AssembledTriangle &tri = triangles[index];
+        float minx = std::min(tri.pts[0].x, std::min(tri.pts[1].x, tri.pts[2].x)) - margin;
+        float miny = std::min(tri.pts[0].y, std::min(tri.pts[1].y, tri.pts[2].y)) - margin;
+        float maxx = std::max(tri.pts[0].x, std::max(tri.pts[1].x, tri.pts[2].x)) + margin;
+        float maxy = std::max(tri.pts[0].y, std::max(tri.pts[1].y, tri.pts[2].y)) + margin;
+        if (maxx < 0 || maxy < 0 || minx > width-1 || miny > height-1)
+            continue;
+
+        int tx0 = std::max(0, (int)minx) / tileSize;
+        int ty0 = std::max(0, (int)miny) / tileSize;
+        int tx1 = std::min(width-1, (int)maxx) / tileSize;
+        int ty1 = std::min(height-1, (int)maxy) / tileSize;
+
+        for (int ty = ty0; ty <= ty1; ty++)
+            for (int tx = tx0; tx <= tx1; tx++)
+                bins[tx + ty*tilesX].push_back(index);
+    }
+}
+
+// Every tile owns its pixels in zBuf and the image so tiles need no
+// synchronisation. Each worker loads the triangle's varyings from the
+// post-transform buffer into its own shader copy.
+void Renderer::drawTiles()
+{
+    int width = image.get_width();
+    int height = image.get_height();
+    int tilesX = (width + tileSize - 1) / tileSize;
+
+    for (auto &w : workerStats)
+        w = RenderStats();
+    for (auto &h : workerHidden)
+        h.clear();
+
+    bool deferred = multisample == 1 && (depthMode == DEFERRED || shadingRate != RATE_1X1);
+    bool coarse = deferred && shadingRate != RATE_1X1;
+    pool->run(bins.size(), [&](int worker, int tile) {
+        ModelShader *s = workerShaders[worker];
+        Vec2i clipMin((tile % tilesX) * tileSize, (tile / tilesX) * tileSize);
+        Vec2i clipMax(std::min(width, clipMin.x + tileSize) - 1, std::min(height, clipMin.y + tileSize) - 1);
+        if (deferred)
+        {
+            clearVisibility(clipMin, clipMax);
+            for (int index : bins[tile])
+                if (!rasterizeVisibility(index, triangles[index].pts, clipMin, clipMax, workerStats[worker]))
+                    workerHidden[worker].push_back(index);
+            if (!coarse)
+                (this->*shadeVisible)(s, clipMin, clipMax, workerStats[worker]);
+            return;
+        }
+        for (int index : bins[tile])
+        {
+            AssembledTriangle &tri = triangles[index];
+            loadTriangle(s, tri);
+            if (!(this->*shadedTriangle)(tri.pts, s, clipMin, clipMax, workerStats[worker]))
+                workerHidden[worker].push_back(index);
         }
-        drawTriangle(screen_coords, shader);
+    });
+    countHiddenTriangles();
+
+    // Coarse shading reads the visibility around each block, so it waits
+    // for every tile and then runs over its own region grid
+    if (coarse)
+    {
+        int regionsX = (width + COARSE_REGION - 1) / COARSE_REGION;
+        int regionsY = (height + COARSE_REGION - 1) / COARSE_REGION;
+        pool->run(regionsX * regionsY, [&](int worker, int region) {
+            Vec2i clipMin((region % regionsX) * COARSE_REGION, (region / regionsX) * COARSE_REGION);
+            Vec2i clipMax(std::min(width, clipMin.x + COARSE_REGION) - 1, std::min(height, clipMin.y + COARSE_REGION) - 1);
+            (this->*shadeCoarse)(workerShaders[worker], clipMin, clipMax, workerStats[worker]);
+        });
+    }
+
+    for (auto &w : workerStats)
+    {
+        stats.fragments += w.fragments;
+        stats.pixels += w.pixels;
+        stats.fragmentMs += w.fragmentMs;
+        stats.rejectedTiles += w.rejectedTiles;
     }
 }
 
+// A triangle is only rejected once every tile it was binned to hid it
+void Renderer::countHiddenTriangles()
+{
+    size_t hidden = 0;
+    for (auto &h : workerHidden)
+        hidden += h.size();
+    if (!hidden)
+        return;
+
+    binsLeft.assign(triangles.size(), 0);
+    for (auto &bin : bins)
+        for (int index : bin)
+            binsLeft[index]++;
+    for (auto &h : workerHidden)
+        for (int index : h)
+            stats.rejectedTriangles += --binsLeft[index] == 0;
+}
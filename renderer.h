@@ -1,15 +1,23 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
 #include "tgaimage.h"
 #include "geometry.h"
 #include <vector>
 #include "model.h"
-
-class ModelShader;
+#include "threadpool.h"
+#include "depthbuffer.h"
+#include "hizbuffer.h"
+#include "multisamplebuffer.h"
+#include "shader.h"
+#include "instancebatch.h"
 
 class Renderer
 {
     public:
     Renderer(TGAImage &image_);
     Renderer(TGAImage &image_, Model* model_);
+    ~Renderer();
     
     void drawTriangle(Vec3f* pts, TGAColor color);
     void drawTriangle(Vec3f* pts, Vec2f* uvs);
@@ -19,18 +27,242 @@ class Renderer
 
     void drawModel();
 
+    // Reset the image and depth buffer for the next frame, keeps all allocations
+    void clear();
+
+    // Binned rendering: triangles are sorted into screen tiles and the tiles
+    // are shaded in parallel. Output is identical to the serial path.
+    void setTiledRendering(bool enabled, int nthreads = 0, int tileSize_ = 64);
+
+    // Rasterization backend for shaded triangles. SIMD picks AVX2 or SSE2 at
+    // runtime and produces the same image as SCALAR.
+    enum Backend {
+        SCALAR, SIMD
+    };
+    void setBackend(Backend backend_) { backend = backend_; }
+
+    // When the depth test happens relative to fragment shading. LATE_Z
+    // shades every covered pixel before testing it, EARLY_Z only shades
+    // pixels that pass. DEFERRED rasterizes the whole model into a visibility
+    // buffer first and then shades every visible pixel exactly once. All
+    // three produce the same image, the SIMD backend always tests early.
+    enum DepthMode {
+        LATE_Z, EARLY_Z, DEFERRED
+    };
+    void setDepthMode(DepthMode mode) { depthMode = mode; }
+
+    // Variable rate shading for the following drawModel calls. The fragment
+    // shader runs once per rate x rate pixel block and that colour fills the
+    // block's covered pixels. Coverage and depth stay per pixel: any rate but
+    // RATE_1X1 renders through the deferred visibility buffer, whatever the
+    // depth mode. Blocks whose colour differs from a neighbour's by more than
+    // threshold in any channel are shaded again at the next finer rate.
+    enum ShadingRate {
+        RATE_1X1 = 1, RATE_2X2 = 2, RATE_4X4 = 4
+    };
+    void setShadingRate(ShadingRate rate, int threshold = 16) { shadingRate = rate; shadingThreshold = threshold; }
+
+    // Multisample anti-aliasing with 4 or 8 rotated grid samples per pixel,
+    // 1 turns it off. Coverage and depth are tested per sample but the
+    // fragment shader runs once per pixel and triangle, and every drawModel
+    // resolves the area it touched into the image with filter. Depth is
+    // always tested early, the deferred depth mode, variable rate shading,
+    // the SIMD backend and hierarchical Z don't apply while it is on.
+    void setMultisample(int samples, MultisampleBuffer::Filter filter = MultisampleBuffer::BOX);
+
+    // Backface culling in primitive assembly, counter-clockwise triangles
+    // on screen are front facing
+    enum CullMode {
+        CULL_NONE, CULL_BACK, CULL_FRONT
+    };
+    void setCullMode(CullMode mode) { cullMode = mode; }
+
+    // Skip 8x8 pixel tiles, and whole triangles, that are behind what is
+    // already in the depth buffer. In tiled mode the tile size has to be a
+    // multiple of 8, otherwise it is ignored.
+    void setHierarchicalZ(bool enabled);
+
+    // Pick the model's level of detail per drawModel from the screen size
+    // of its bounding sphere: the finest level whose triangles cover at
+    // least pixelsPerTriangle pixels each on average. 0 always draws the
+    // full mesh. Needs Model::generateLods.
+    void setLodSelection(float pixelsPerTriangle) { lodPixelsPerTriangle = pixelsPerTriangle; }
+
+    // Post-transform vertex cache counters of the last drawModel. Each unique
+    // vertex is transformed on its first use in a frame, later uses are hits.
+    struct VertexCacheStats
+    {
+        long lookups;
+        long transforms;
+        double hitRate() const { return lookups ? 1. - (double)transforms/lookups : 0.; }
+    };
+    const VertexCacheStats &vertexCacheStats() const { return cacheStats; }
+
+    // Counters and stage timings of the last drawModel. In tiled mode the
+    // fragment time is summed over all workers.
+    struct RenderStats
+    {
+        long triangles;     // faces submitted
+        long outside;       // rejected by the view frustum
+        long backfaces;     // culled by orientation
+        long clipped;       // faces that crossed the near plane or guard band
+        long assembled;     // triangles sent to the rasterizer
+        long fragments;     // fragment shader invocations
+        long pixels;        // pixels that passed the depth test
+        double vertexMs;    // vertex processing, triangle assembly and binning
+        double rasterMs;    // rasterization including fragment shading
+        double fragmentMs;  // fragment shading alone, only with profiling on
+        long rejectedTriangles; // skipped entirely by the hierarchical Z
+        long rejectedTiles;     // 8x8 tiles skipped by the hierarchical Z
+        long instances;         // submitted to drawInstanced
+        long culledInstances;   // rejected by their bounding sphere
+
+        RenderStats &operator+=(const RenderStats &s);
+    };
+    const RenderStats &renderStats() const { return stats; }
+    // Time every fragment shader call, adds noticeable overhead
+    void setProfileFragments(bool enabled) { profileFragments = enabled; }
+
+    // Draw another model, the shader follows it. Its textures are resolved
+    // here, as in the constructor, so draws never load them.
+    void setModel(Model *model_);
+    // Object to world transform for the following drawModel calls
+    void setModelMatrix(const Mat4 &m);
+    // World to clip space of the shader's camera
+    Mat4 viewProjection() const { return shader->viewProjection(); }
+    void setCamera(const Camera &camera);
+    // Shadow the following drawModel calls with map, nullptr turns shadows
+    // off. The map is only read, render it before drawing.
+    void setShadowMap(const ShadowMap *map);
+
+    // Draw the current model once per transform. Only the frustum culling
+    // and the matrices are done in SIMD friendly batches, every visible
+    // instance then goes through drawModel on its own, vertex stage
+    // included. tints, if given, modulate each instance's shaded colour.
+    // The image is the same as calling setModelMatrix and drawModel for
+    // every instance, renderStats() sums over all of them. The model
+    // matrix set before the call is left in place.
+    void drawInstanced(const Mat4 *transforms, int count, const TGAColor *tints = nullptr);
+
+    // Replace the shader, the renderer takes ownership. The built in shader
+    // types get a raster loop specialized for them with the fragment shader
+    // inlined, any other ModelShader goes through the virtual interface.
+    void setShader(ModelShader *shader_);
+
 
     private:
 
     ModelShader *shader;
 
-    std::vector<std::vector<float>> zBuf;
+    DepthBuffer zBuf;
     TGAImage &image;
     Model* model;
 
     void init();
 
-    Matrix viewport;
+    Mat4 viewport;
+    Mat4 modelMatrix;
+    float lodPixelsPerTriangle;
+    Backend backend;
+    DepthMode depthMode;
+    ShadingRate shadingRate;
+    int shadingThreshold;
+    int multisample;
+    MultisampleBuffer::Filter resolveFilter;
+    MultisampleBuffer msaa;
+    HiZBuffer hiZ;
+    bool hierarchicalZ;
+
+    // Deferred mode: nearest assembled triangle and its barycentric
+    // coordinates per pixel, -1 where the current drawModel drew nothing
+    struct VisibilitySample
+    {
+        int triangle;
+        Vec3f bc;
+    };
+    std::vector<VisibilitySample> visibility;
+
+    // Post-transform buffer indexed by Model::vertexId, entries are valid
+    // when their frame stamp matches the current frame. Vertices made by
+    // clipping are appended after the model's.
+    std::vector<ShadedVertex> postTransform;
+    std::vector<Vec3f> postScreen;
+    std::vector<unsigned> postFrame;
+    // Tangent frames beside postTransform, only for shaders that use them
+    std::vector<VertexFrame> postFrames;
+    bool vertexFrames;
+    unsigned frame;
+    VertexCacheStats cacheStats;
+
+    RenderStats stats;
+    bool profileFragments;
+    std::vector<RenderStats> workerStats;
+
+    // Per instance colour of drawInstanced, applied after fragment shading
+    bool tinted;
+    TGAColor tint;
+    InstanceBatch instanceBatch;
+
+    int selectLod() const;
+    void beginVertexFrame();
+    int fetchVertex(int face, int nthvert);
+    Vec3f toScreen(const Vec3f &ndc) const;
+
+    // Primitive assembly output, reused across frames
+    struct AssembledTriangle
+    {
+        Vec3f pts[3];
+        int ids[3];
+    };
+    CullMode cullMode;
+    std::vector<AssembledTriangle> triangles;
+
+    void assembleTriangles();
+    void clipTriangle(const int ids[3], int planes);
+    void emitTriangle(int a, int b, int c);
+
+    // Tiled rendering state, reused across frames
+    bool tiled;
+    int tileSize;
+    ThreadPool *pool;
+    std::vector<ModelShader*> workerShaders;
+    std::vector<std::vector<int>> bins;
+    // Triangles each worker's tiles hid behind the hierarchical Z, and the
+    // bins per triangle left to do so before it counts as rejected
+    std::vector<std::vector<int>> workerHidden;
+    std::vector<int> binsLeft;
+
+    void binTriangles();
+    void drawTiles();
+    void countHiddenTriangles();
+    void resolveMultisample();
+
+    // Raster and deferred shading loops for the dynamic type of the current shader
+    typedef bool (Renderer::*ShadedTriangleFn)(Vec3f* pts, ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    typedef void (Renderer::*ShadeVisibleFn)(ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    ShadedTriangleFn shadedTriangle;
+    ShadeVisibleFn shadeVisible;
+    ShadeVisibleFn shadeCoarse;
+    void selectShadedTriangle();
+    template <class Shader>
+    bool drawTriangle(Vec3f* pts, ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    template <class Shader>
+    void shadeVisibleSamples(ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    template <class Shader>
+    void shadeVisibleCoarse(ModelShader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    template <class Shader>
+    void shadeCoarseRegion(Shader* shader, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
+    template <class Shader>
+    TGAColor shadeFragment(Shader* shader, const Vec3f &bc, RenderStats &counters);
+    template <class Shader>
+    void loadTriangle(Shader* shader, const AssembledTriangle &tri);
+
+    template <class F>
+    bool rasterizeUnoccluded(const Vec3f* pts, Vec2i clipMin, Vec2i clipMax, RenderStats &counters, F &&raster);
+
+    // Deferred mode passes
+    void clearVisibility(Vec2i clipMin, Vec2i clipMax);
+    bool rasterizeVisibility(int index, Vec3f* pts, Vec2i clipMin, Vec2i clipMax, RenderStats &counters);
 
     //float *zbuffer;
 };
@@ -43,3 +275,4 @@ void drawTriangle(Vec2i* pts, TGAImage &image, TGAColor color);
 Vec3f barycentric(Vec2i *pts, Vec2i P);
 Vec3f barycentric(Vec3f A, Vec3f B, Vec3f C, Vec3f P); 
 
+#endif //__RENDERER_H__
@@ -0,0 +1,131 @@
+#include "scene.h"
+#include <algorithm>
+#include <numeric>
+
+Scene::Scene()
+    :dirty(false), stats_()
+{
+}
+
+int Scene::addInstance(Model *model, const Mat4 &transform)
+{
+    instances.push_back(Instance());
+    instances.back().model = model;
+    setTransform(instances.size() - 1, transform);
+    return instances.size() - 1;
+}
+
+void Scene::setTransform(int instance, const Mat4 &transform)
+{
+    Instance &inst = instances[instance];
+    inst.transform = transform;
+    inst.bounds = inst.model->bounds().transformed(transform);
+    inst.sphere = inst.model->boundingSphere().transformed(transform);
+    dirty = true;
+}
+
+// Top down median split along the longest axis of the instance centers
+void Scene::build()
+{
+    nodes.clear();
+    order.resize(instances.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (!instances.empty())
+    {
+        nodes.push_back(Node());
+        buildNode(0, 0, instances.size());
+    }
+    dirty = false;
+}
+
+void Scene::buildNode(int index, int first, int count)
+{
+    AABB bounds, centers;
+    for (int i = first; i < first + count; i++)
+    {
+        bounds.extend(instances[order[i]].bounds);
+        centers.extend(instances[order[i]].bounds.center());
+    }
+    nodes[index].bounds = bounds;
+
+    if (count <= LEAF_SIZE)
+    {
+        nodes[index].left = -1;
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return;
+    }
+
+    Vec3f extent = centers.extent();
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int mid = first + count/2;
+    std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](int a, int b) {
+        return instances[a].bounds.center()[axis] < instances[b].bounds.center()[axis];
+    });
+
+    // Siblings are allocated together so a node only stores its left child
+    int left = nodes.size();
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+    nodes[index].left = left;
+    nodes[index].first = 0;
+    nodes[index].count = 0;
+    buildNode(left, first, mid - first);
+    buildNode(left + 1, mid, first + count - mid);
+}
+
+void Scene::cull(const Mat4 &viewProj, std::vector<int> &visible)
+{
+    if (dirty)
+        build();
+
+    visible.clear();
+    stats_.instances = instances.size();
+    stats_.nodesVisited = 0;
+    if (nodes.empty())
+        return;
+
+    Frustum frustum(viewProj);
+    stack.clear();
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const Node &node = nodes[stack.back()];
+        stack.pop_back();
+        stats_.nodesVisited++;
+        if (!frustum.intersects(node.bounds))
+            continue;
+
+        if (node.left < 0)
+        {
+            for (int i = node.first; i < node.first + node.count; i++)
+            {
+                const Instance &inst = instances[order[i]];
+                if (frustum.intersects(inst.sphere) && frustum.intersects(inst.bounds))
+                    visible.push_back(order[i]);
+            }
+            continue;
+        }
+        stack.push_back(node.left + 1);
+        stack.push_back(node.left);
+    }
+
+    // Keep the draw order independent of the tree layout
+    std::sort(visible.begin(), visible.end());
+}
+
+void Scene::draw(Renderer &renderer)
+{
+    cull(renderer.viewProjection(), drawList);
+    stats_.visible = drawList.size();
+    stats_.render = Renderer::RenderStats();
+
+    for (int index : drawList)
+    {
+        const Instance &inst = instances[index];
+        renderer.setModel(inst.model);
+        renderer.setModelMatrix(inst.transform);
+        renderer.drawModel();
+        stats_.render += renderer.renderStats();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "renderer.h"
+
+// A set of model instances. Instances only point at their Model, so one
+// mesh and its textures can be drawn any number of times. A bounding volume
+// hierarchy over the instances' world bounds culls everything outside the
+// camera frustum before any vertex is transformed.
+class Scene
+{
+    public:
+    Scene();
+
+    // The model must outlive the scene. Returns the instance index.
+    int addInstance(Model *model, const Mat4 &transform = Mat4::identity());
+    void setTransform(int instance, const Mat4 &transform);
+    int ninstances() const { return instances.size(); }
+
+    // Instances whose bounds touch the frustum of viewProj, in insertion order
+    void cull(const Mat4 &viewProj, std::vector<int> &visible);
+
+    // Cull against the renderer's camera and draw what is left
+    void draw(Renderer &renderer);
+
+    struct Stats
+    {
+        long instances;     // in the scene
+        long visible;       // drawn after culling
+        long nodesVisited;  // BVH nodes tested
+        Renderer::RenderStats render;   // summed over the drawn instances
+    };
+    const Stats &stats() const { return stats_; }
+
+    private:
+    struct Instance
+    {
+        Model *model;
+        Mat4 transform;
+        AABB bounds;            // world space
+        BoundingSphere sphere;  // world space
+    };
+
+    // Leaves hold up to LEAF_SIZE instances in order[first, first+count),
+    // inner nodes have count 0 and children left and left+1
+    struct Node
+    {
+        AABB bounds;
+        int left;
+        int first;
+        int count;
+    };
+    static const int LEAF_SIZE = 4;
+
+    std::vector<Instance> instances;
+    std::vector<Node> nodes;
+    std::vector<int> order;
+    std::vector<int> drawList;
+    std::vector<int> stack;
+    bool dirty;
+    Stats stats_;
+
+    void build();
+    void buildNode(int index, int first, int count);
+};
+
+#endif //__SCENE_H__
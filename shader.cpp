@@ -1,16 +1,48 @@
 #include "shader.h"
 #include <vector>
-template<class T>
-T interpolate(T v[], Vec3f barCoords) {
-    return v[0] * barCoords[0] + v[1] * barCoords[1] + v[2] * barCoords[2];
+
+
+ShadedVertex lerp(const ShadedVertex &a, const ShadedVertex &b, float t)
+{
+    ShadedVertex r;
+    r.clip = a.clip + (b.clip - a.clip) * t;
+    r.position = r.clip.proj();
+    r.object = a.object + (b.object - a.object) * t;
+    r.normal = a.normal + (b.normal - a.normal) * t;
+    r.uv = a.uv + (b.uv - a.uv) * t;
+    r.intensity = a.intensity + (b.intensity - a.intensity) * t;
+    r.viewDir = a.viewDir + (b.viewDir - a.viewDir) * t;
+    r.shadow = a.shadow + (b.shadow - a.shadow) * t;
+    return r;
 }
 
+VertexFrame lerp(const VertexFrame &a, const VertexFrame &b, float t)
+{
+    VertexFrame r;
+    r.tangent = a.tangent + (b.tangent - a.tangent) * t;
+    r.bitangent = a.bitangent + (b.bitangent - a.bitangent) * t;
+    r.normal = a.normal + (b.normal - a.normal) * t;
+    return r;
+}
 
 ModelShader::ModelShader(Model *model_)
     : model(model_)
 {
 }
 
+Vec3f ModelShader::vertexShader(int face, int vertIndex)
+{
+    if (usesVertexFrame())
+    {
+        VertexFrame f;
+        transformFrame(face, vertIndex, f);
+        loadFrame(vertIndex, f);
+    }
+    ShadedVertex v;
+    transformVertex(face, vertIndex, v);
+    return loadVertex(vertIndex, v);
+}
+
 void SimpleModelShader::initMatrices()
 {
     // Creat the perspective Matrix which is
@@ -20,129 +52,105 @@ void SimpleModelShader::initMatrices()
     // [0 0 D 1]
     // D = -1/d
     // d = distance from origin
-    perspective = Matrix::identity();
-    perspective[3][2] = -1.f/1.f;
-    
-    viewport = Matrix::viewport(800, 800, 0, 0);
+    perspective = Mat4::identity();
+    perspective[3][2] = -1.f/camera.distance;
 
-    eye = Vec3f(.5f, 0.2f, .6f);
-    view = Matrix::camLookAt(Vec3f(0.f,1.f,0.f), Vec3f(0.f,0.f,0.f), eye);
+    view = Mat4::camLookAt(camera.up, camera.center, camera.eye);
+    lightView = (transformPoint(perspective * view, lightDir) * -1).normalize();
+    setModelMatrix(model2world);
+}
 
-    M = (perspective * view);
-    //M.print();
-    MIT = (perspective * view).inverse().transpose();
-    //MI.print();
+void SimpleModelShader::setModelMatrix(const Mat4 &m)
+{
+    Mat4 mvp = perspective * view * m;
+    setModelTransforms(m, mvp, mvp.inverse().transpose());
+}
+
+void SimpleModelShader::setModelTransforms(const Mat4 &m, const Mat4 &mvp, const Mat4 &mvpInvT)
+{
+    model2world = m;
+    M = mvp;
+    MIT = mvpInvT;
+}
 
+void SimpleModelShader::setCamera(const Camera &camera_)
+{
+    camera = camera_;
+    initMatrices();
 }
 
 SimpleModelShader::SimpleModelShader(Model *model_ , Vec3f lightDir_)
-    :ModelShader(model_), lightDir(lightDir_)
+    :ModelShader(model_), lightDir(lightDir_), model2world(Mat4::identity()), shadowMap(nullptr)
 {   
     initMatrices();
     //lightDir = (M * lightDir).normalize();
     //lightDir.normalize();
 }
 
-Vec3f SimpleModelShader::vertexShader(int face, int vertIndex)
+void SimpleModelShader::transformVertex(int face, int vertIndex, ShadedVertex &out)
 {
-    vertCoords[vertIndex]= model->vert(face, vertIndex);
-    Vec3f v = (M * Matrix::v2m(vertCoords[vertIndex])).toVec();
+    out.object = model->vert(face, vertIndex);
+    out.clip = M * Vec4f(out.object, 1.f);
+    out.position = out.clip.proj();
     
     // Calculate transformed normal
-    auto N = Matrix::v2m(model->normal(face, vertIndex));
-    N[3][0] = 0.f;
-    Vec3f n = (MIT * N).toVec().normalize();
-    normals[vertIndex] = n;
+    Vec4f N(model->normal(face, vertIndex), 0.f);
+    out.normal = (MIT * N).proj().normalize();
     
-    intensity[vertIndex] = -std::min(0.f, lightDir * n);
-    uvs[vertIndex] = model->uv(face, vertIndex);
-    
-    return Vec3f(v.x, v.y, v.z);
+    out.intensity = -std::min(0.f, lightDir * out.normal);
+    out.uv = model->uv(face, vertIndex);
+    if (shadowMap)
+        out.shadow = transformPoint(shadowMap->worldToMap(), transformPoint(model2world, out.object));
 }
 
-TGAColor SimpleModelShader::fragShader(Vec3f barCoords)
-{   
-    return white * (intensity * barCoords);
+Vec3f SimpleModelShader::loadVertex(int vertIndex, const ShadedVertex &v)
+{
+    vertCoords[vertIndex] = v.object;
+    normals[vertIndex] = v.normal;
+    intensity[vertIndex] = v.intensity;
+    uvs[vertIndex] = v.uv;
+    shadowCoords[vertIndex] = v.shadow;
+    return v.position;
 }
 
-TGAColor SimpleTextureModelShader::fragShader(Vec3f barCoords)
-{   
-    auto uv = interpolate(uvs, barCoords);
-    auto N = Matrix::v2m(model->normal(uv));
-    N[3][0] = 0.f;
-    Vec3f n = (MIT * N).toVec().normalize();
-    Vec3f l = ((M * lightDir) * -1).normalize();
-    //n = interpolate(normals, barCoords);
-    float intensity = std::max(0.f, n*l);
-    auto color = model->diffuse(uv) * intensity;
-    return color;
+void SimpleModelShader::transformFrame(int face, int vertIndex, VertexFrame &out)
+{
+    Vec3f n = model->normal(face, vertIndex);
+    Vec4f t = model->tangent(face, vertIndex);
+    out.tangent = MIT * Vec4f(t.xyz(), 0.f);
+    out.bitangent = MIT * Vec4f(cross(n, t.xyz()) * t.w, 0.f);
+    out.normal = MIT * Vec4f(n, 0.f);
 }
 
-Vec3f TextureModelShader::vertexShader(int face, int vertIndex)
+void SimpleModelShader::setScreenTriangle(const Vec3f *pts)
 {
-    auto out = SimpleModelShader::vertexShader(face, vertIndex);
-    viewDir[vertIndex] = (eye - out).normalize();
-    worldCoords[vertIndex] = out;
-
-    return out;
+    // uv is affine in screen space, so its derivatives are constant per triangle
+    float area = (pts[1].x-pts[0].x)*(pts[2].y-pts[0].y) - (pts[2].x-pts[0].x)*(pts[1].y-pts[0].y);
+    if (std::abs(area) < 1e-6f)
+    {
+        uvGradient = UvGradient();
+        texLod = model->textureLod(uvGradient);
+        return;
+    }
+    Vec2f e1 = uvs[1] - uvs[0];
+    Vec2f e2 = uvs[2] - uvs[0];
+    // Barycentric derivatives of the second and third vertex
+    float b1dx =  (pts[2].y-pts[0].y)/area, b1dy = -(pts[2].x-pts[0].x)/area;
+    float b2dx = -(pts[1].y-pts[0].y)/area, b2dy =  (pts[1].x-pts[0].x)/area;
+    uvGradient.dx = e1*b1dx + e2*b2dx;
+    uvGradient.dy = e1*b1dy + e2*b2dy;
+    texLod = model->textureLod(uvGradient);
 }
 
-TGAColor TextureModelShader::fragShader(Vec3f barCoords)
-{   
-    const float difConstant = 1.0f;
-    Vec2f interpolatedUv = interpolate(uvs, barCoords);
-
-    /*
-    // Even though direction vector and not position don't need to do N[3] = 0 as were normalizing it
-    Vec3f n = interpolate(normals, barCoords).normalize();
-    
-    // Calculate Darbboux basis
-    Matrix matA  = Matrix::identity(3);
-    auto p1p0 = (worldCoords[1] - worldCoords[0]).raw;
-    auto p2p0 = (worldCoords[2] - worldCoords[0]).raw;
-    matA[0] = std::vector<float>(p1p0, p1p0 + 3);
-    matA[1] = std::vector<float>(p2p0, p2p0 + 3);
-    matA[2] = std::vector<float>(n.raw, n.raw + 3);
-
-
-    Matrix matAI = matA.inverse();
-    
-    auto I = matAI * Matrix::v2m(Vec3f(uvs[1][0] - uvs[0][0], uvs[2][0] - uvs[0][0], 0), false);
-    Vec3f i = Vec3f(I[0][0], I[1][0], I[2][0]);
-    auto J = matAI * Matrix::v2m(Vec3f(uvs[1][1] - uvs[0][1], uvs[2][1] - uvs[0][1], 0), false);
-    Vec3f j = Vec3f(J[0][0], J[1][0], J[2][0]);
-
-    Matrix B(3, 3);
-    B.setCol(0, i.normalize().raw);
-    B.setCol(1, j.normalize().raw);
-    B.setCol(2, n.raw);
-    
-    auto r = B * Matrix::v2m(model->normal(interpolatedUv), false);
-    n = Vec3f(r[0][0], r[1][0], r[2][0]).normalize();
+void TextureModelShader::transformVertex(int face, int vertIndex, ShadedVertex &out)
+{
+    SimpleModelShader::transformVertex(face, vertIndex, out);
+    out.viewDir = (camera.eye - out.position).normalize();
+}
 
-    */
-    Matrix bn = Matrix::v2m(model->normal(interpolatedUv));
-    if (TANGENT_SPACE)
-    {
-        auto k = model->normal(interpolatedUv);
-        k[2] = 0.f;
-        //k = k.normalize();
-        bn = Matrix::v2m(k);
-    }
-    Vec3f n = (MIT * bn).toVec().normalize();
-    // lightDir is the direction the light is coming from so invert to get the opposite vector 
-    // TODO ^^^^ change this, maybe?
-    Vec3f reflectDir =   n * -2 * (lightDir * n) + lightDir;
-    
-    // Get the diffuse colour from the texture map
-    TGAColor col = model->diffuse(interpolatedUv);
-    
-    // Direction of the cam and calculate diffuse + specular coefficiants
-    Vec3f V = interpolate(viewDir, barCoords);
-    float specular = std::pow(std::max(0.f, reflectDir * V), model->specular(interpolatedUv));
-    float diffuse = -std::min(0.0f, lightDir * n) * difConstant;
-
-    for(int i = 0; i < 3; i ++)
-        col[i] = std::min<int>(255, col[i] * (diffuse + specular));
-    return col;
+Vec3f TextureModelShader::loadVertex(int vertIndex, const ShadedVertex &v)
+{
+    viewDir[vertIndex] = v.viewDir;
+    worldCoords[vertIndex] = v.position;
+    return SimpleModelShader::loadVertex(vertIndex, v);
 }
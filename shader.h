@@ -1,13 +1,95 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
 #include "tgaimage.h"
 #include "geometry.h"
 #include <vector>
 #include "model.h"
+#include "shadowmap.h"
+#include <cmath>
+#include <algorithm>
+
+template<class T>
+T interpolate(T v[], Vec3f barCoords) {
+    return v[0] * barCoords[0] + v[1] * barCoords[1] + v[2] * barCoords[2];
+}
+
+// Everything the vertex stage produces for one (vertex, uv, normal) tuple.
+// It only depends on the tuple so it can be computed once and reused by
+// every face sharing it.
+struct ShadedVertex
+{
+    Vec4f clip;         // after M, before the perspective divide
+    Vec3f position;     // after M and the perspective divide
+    Vec3f object;       // model space position
+    Vec3f normal;
+    Vec2f uv;
+    float intensity;
+    Vec3f viewDir;
+    Vec3f shadow;       // shadow map space position, if the shader has a map
+};
+
+// Vertex at t along the clip space edge a-b, for the vertices clipping creates
+ShadedVertex lerp(const ShadedVertex &a, const ShadedVertex &b, float t);
+
+// Tangent frame of a vertex for tangent space normal maps, already taken to
+// the shader's lighting space as directions, so a pixel only weighs the
+// three axes by the map's normal. Only shaders reading such a map make one,
+// the renderer keeps them beside the post-transform cache.
+struct VertexFrame
+{
+    Vec4f tangent;
+    Vec4f bitangent;
+    Vec4f normal;
+};
+
+VertexFrame lerp(const VertexFrame &a, const VertexFrame &b, float t);
+
+// Look-at camera of the built in shaders. The projection puts w = 1 - z/distance
+// in view space, smaller distances give a stronger perspective.
+struct Camera
+{
+    Vec3f eye;
+    Vec3f center;
+    Vec3f up;
+    float distance;
+    Camera() : eye(.5f, .2f, .6f), center(0.f, 0.f, 0.f), up(0.f, 1.f, 0.f), distance(1.f) {}
+};
 
 class ModelShader {
 public:
     ModelShader(Model *model_);
-    virtual Vec3f vertexShader(int face, int vertIndex) = 0;
+    // Per vertex work, writes the result to out without touching the varyings
+    virtual void transformVertex(int face, int vertIndex, ShadedVertex &out) = 0;
+    // Set corner vertIndex of the current triangle, returns its position
+    virtual Vec3f loadVertex(int vertIndex, const ShadedVertex &v) = 0;
+    // transformVertex followed by loadVertex
+    virtual Vec3f vertexShader(int face, int vertIndex);
+    // True if the shader needs the vertices' tangent frames, passed through
+    // transformFrame and loadFrame like the vertices themselves
+    virtual bool usesVertexFrame() const { return false; }
+    virtual void transformFrame(int face, int vertIndex, VertexFrame &out) {}
+    virtual void loadFrame(int vertIndex, const VertexFrame &f) {}
+    // Called with the screen positions before a triangle is rasterized
+    virtual void setScreenTriangle(const Vec3f *pts) {}
     virtual TGAColor fragShader(Vec3f barCoords) = 0;
+    // Copy with its own varyings so worker threads can shade independently
+    virtual ModelShader* clone() const = 0;
+    virtual ~ModelShader() {}
+
+    // Mesh and textures the shader reads, lets one shader draw several models
+    void setModel(Model *model_) { model = model_; }
+    // Object to world transform of what is drawn next
+    virtual void setModelMatrix(const Mat4 &m) {}
+    // setModelMatrix with the derived matrices already computed, mvp is
+    // viewProjection() * m and mvpInvT its inverse transpose
+    virtual void setModelTransforms(const Mat4 &m, const Mat4 &mvp, const Mat4 &mvpInvT) { setModelMatrix(m); }
+    virtual void setCamera(const Camera &camera) {}
+    // Shadow map the fragment shader darkens occluded points with, nullptr
+    // for none. The map isn't copied, it has to outlive its use.
+    virtual void setShadowMap(const ShadowMap *map) {}
+    // World to clip space, used to cull whole objects. Identity if the
+    // shader has no camera.
+    virtual Mat4 viewProjection() const { return Mat4::identity(); }
 
 protected:
     Model *model;
@@ -17,8 +99,18 @@ class SimpleModelShader : public ModelShader
 {
 public:
     SimpleModelShader(Model *model_, Vec3f lightDir_ = Vec3f(0.f, -1.f, 0.f));
-    virtual Vec3f vertexShader(int face, int vertIndex) override;
+    virtual void transformVertex(int face, int vertIndex, ShadedVertex &out) override;
+    virtual Vec3f loadVertex(int vertIndex, const ShadedVertex &v) override;
+    virtual void transformFrame(int face, int vertIndex, VertexFrame &out) override;
+    virtual void loadFrame(int vertIndex, const VertexFrame &f) override { frames[vertIndex] = f; }
+    virtual void setScreenTriangle(const Vec3f *pts) override;
     virtual TGAColor fragShader(Vec3f barCoords) override;
+    virtual ModelShader* clone() const override { return new SimpleModelShader(*this); }
+    virtual void setModelMatrix(const Mat4 &m) override;
+    virtual void setModelTransforms(const Mat4 &m, const Mat4 &mvp, const Mat4 &mvpInvT) override;
+    virtual void setCamera(const Camera &camera_) override;
+    virtual void setShadowMap(const ShadowMap *map) override { shadowMap = map; }
+    virtual Mat4 viewProjection() const override { return perspective * view; }
 
 protected:
     // Passed between shader (varying)
@@ -26,26 +118,57 @@ protected:
     Vec2f uvs[3];
     Vec3f normals[3];
     Vec3f intensity;
+    // Screen space uv derivatives of the current triangle, for mip selection
+    UvGradient uvGradient;
+    Model::TextureLod texLod;
+    Vec3f shadowCoords[3];
+    VertexFrame frames[3];
 
-    Vec3f eye;
+    Camera camera;
     Vec3f lightDir;
+    // Light direction in view space pointing at the light, per shader constant
+    Vec3f lightView;
     
-    Matrix perspective;
-    Matrix view;
-    Matrix viewport;
+    Mat4 perspective;
+    Mat4 view;
+    Mat4 model2world;
     // Transformation Matrix
-    Matrix M;
+    Mat4 M;
     // Transformation Matrix Inverse Transpose
-    Matrix MIT;
+    Mat4 MIT;
+
+    const ShadowMap *shadowMap;
 
     void initMatrices();
+    // Frames are only needed by the shaders reading the normal map
+    inline bool tangentSpaceMap() const { return model->normalMapSpace() == Model::TANGENT_SPACE; }
+    // Normal map lookup as MIT * (n, 0), n the model space normal. A tangent
+    // space map is weighed by the interpolated frame, already through MIT.
+    inline Vec4f mappedNormal(Vec2f uv, Vec3f barCoords)
+    {
+        Vec3f n = model->normal(uv, texLod);
+        if (!tangentSpaceMap())
+            return MIT * Vec4f(n, 0.f);
+        const Vec3f &bc = barCoords;
+        Vec4f t = frames[0].tangent * bc.x + frames[1].tangent * bc.y + frames[2].tangent * bc.z;
+        Vec4f b = frames[0].bitangent * bc.x + frames[1].bitangent * bc.y + frames[2].bitangent * bc.z;
+        Vec4f N = frames[0].normal * bc.x + frames[1].normal * bc.y + frames[2].normal * bc.z;
+        return t * n.x + b * n.y + N * n.z;
+    }
+    // Lit fraction of the point at barCoords
+    inline float shadowing(Vec3f barCoords)
+    {
+        return shadowMap ? shadowMap->lookup(interpolate(shadowCoords, barCoords)) : 1.f;
+    }
 };
 
 class SimpleTextureModelShader : public SimpleModelShader
 {
 public:
     using SimpleModelShader::SimpleModelShader;
+    virtual bool usesVertexFrame() const override { return tangentSpaceMap(); }
     virtual TGAColor fragShader(Vec3f barCoords) override;
+    virtual ModelShader* clone() const override { return new SimpleTextureModelShader(*this); }
 };
 
 class TextureModelShader : public SimpleModelShader
@@ -54,10 +177,68 @@ public:
     using SimpleModelShader::SimpleModelShader;
     //TextureModelShader(Model *model_, Vec3f lightDir_ = Vec3f(0.f, -1.f, 0.f));
     
-    virtual Vec3f vertexShader(int face, int vertIndex) override;
+    virtual void transformVertex(int face, int vertIndex, ShadedVertex &out) override;
+    virtual Vec3f loadVertex(int vertIndex, const ShadedVertex &v) override;
+    virtual bool usesVertexFrame() const override { return tangentSpaceMap(); }
     virtual TGAColor fragShader(Vec3f barCoords) override;
+    virtual ModelShader* clone() const override { return new TextureModelShader(*this); }
 
 protected:
     Vec3f viewDir[3];
     Vec3f worldCoords[3];
-};
\ No newline at end of file
+};
+
+// The fragment shaders are defined here so the renderer's per shader raster
+// loops can inline them
+
+inline TGAColor SimpleModelShader::fragShader(Vec3f barCoords)
+{   
+    if (shadowMap)
+        return white * (intensity * barCoords * shadowing(barCoords));
+    return white * (intensity * barCoords);
+}
+
+inline TGAColor SimpleTextureModelShader::fragShader(Vec3f barCoords)
+{   
+    auto uv = interpolate(uvs, barCoords);
+    Vec3f n = mappedNormal(uv, barCoords).proj().normalize();
+    //n = interpolate(normals, barCoords);
+    float intensity = std::max(0.f, n*lightView);
+    if (shadowMap)
+        intensity *= shadowing(barCoords);
+    auto color = model->diffuse(uv, texLod) * intensity;
+    return color;
+}
+
+inline TGAColor TextureModelShader::fragShader(Vec3f barCoords)
+{   
+    const float difConstant = 1.0f;
+    Vec2f interpolatedUv = interpolate(uvs, barCoords);
+
+    // MIT applied to the normal as a point, (n, 1)
+    Vec4f origin(MIT[0][3], MIT[1][3], MIT[2][3], MIT[3][3]);
+    Vec3f n = (mappedNormal(interpolatedUv, barCoords) + origin).proj().normalize();
+    // lightDir is the direction the light is coming from so invert to get the opposite vector 
+    // TODO ^^^^ change this, maybe?
+    Vec3f reflectDir =   n * -2 * (lightDir * n) + lightDir;
+    
+    // Get the diffuse colour from the texture map
+    TGAColor col = model->diffuse(interpolatedUv, texLod);
+    
+    // Direction of the cam and calculate diffuse + specular coefficiants
+    Vec3f V = interpolate(viewDir, barCoords);
+    float specular = std::pow(std::max(0.f, reflectDir * V), model->specular(interpolatedUv, texLod));
+    float diffuse = -std::min(0.0f, lightDir * n) * difConstant;
+    if (shadowMap)
+    {
+        float lit = shadowing(barCoords);
+        specular *= lit;
+        diffuse *= lit;
+    }
+
+    for(int i = 0; i < 3; i ++)
+        col[i] = std::min<int>(255, col[i] * (diffuse + specular));
+    return col;
+}
+
+#endif //__SHADER_H__
@@ -0,0 +1,56 @@
+#include "shadowmap.h"
+#include <cmath>
+#include "raster.h"
+
+ShadowMap::ShadowMap(int size)
+    :depth(size, size), direction(0.f, -1.f, 0.f), toMap(Mat4::identity()), bias(0.f), filterRadius(0), ntriangles(0)
+{
+    setLight(direction, BoundingSphere(Vec3f(0.f, 0.f, 0.f), 1.f));
+}
+
+void ShadowMap::setLight(Vec3f direction_, const BoundingSphere &bounds)
+{
+    direction = direction_.normalize();
+    float radius = std::max(bounds.radius, 1e-6f);
+    Vec3f up = std::abs(direction.y) > .99f ? Vec3f(1.f, 0.f, 0.f) : Vec3f(0.f, 1.f, 0.f);
+    Vec3f eye = bounds.center - direction * (2.f * radius);
+    Mat4 view = Mat4::camLookAt(up, bounds.center, eye);
+
+    // The sphere's extent in x and y onto the texel centres, depth stays in
+    // world units so the bias doesn't depend on the map size
+    float scale = (size() - 1) / (2.f * radius);
+    Mat4 project = Mat4::identity();
+    project[0][0] = scale;
+    project[1][1] = scale;
+    project[0][3] = (size() - 1) / 2.f;
+    project[1][3] = (size() - 1) / 2.f;
+    toMap = project * view;
+    bias = 2.f / scale;
+}
+
+void ShadowMap::clear()
+{
+    depth.clear();
+    ntriangles = 0;
+}
+
+void ShadowMap::render(Model *model, const Mat4 &m)
+{
+    ArrayView<Vec3f> positions = model->positions();
+    projected.resize(positions.size());
+    Mat4 t = toMap * m;
+    for (size_t i = 0; i < positions.size(); i++)
+        projected[i] = transformPoint(t, positions[i]);
+
+    // Both orientations are drawn, a closed mesh's back faces keep its
+    // front faces from shadowing themselves where the bias falls short
+    Vec2i clipMax(size() - 1, size() - 1);
+    int n = model->nfaces();
+    for (int i = 0; i < n; i++)
+    {
+        ArrayView<uint32_t> face = model->face(i);
+        Vec3f pts[3] = {projected[face[0]], projected[face[1]], projected[face[2]]};
+        rasterizeDepthOnly(pts, Vec2i(0, 0), clipMax, depth);
+    }
+    ntriangles += n;
+}
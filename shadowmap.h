@@ -0,0 +1,83 @@
+#ifndef __SHADOWMAP_H__
+#define __SHADOWMAP_H__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "geometry.h"
+#include "depthbuffer.h"
+#include "model.h"
+
+// Depth of the scene as seen from a directional light. The light looks along
+// its direction through an orthographic projection framing a bounding
+// sphere, so everything inside the sphere can cast a shadow. render() runs
+// no shader at all: every position is transformed once and the faces are
+// rasterized depth only. Larger z is closer to the light, as in DepthBuffer.
+class ShadowMap
+{
+    public:
+    ShadowMap(int size = 1024);
+
+    // direction is the way the light travels, in world space
+    void setLight(Vec3f direction, const BoundingSphere &bounds);
+    inline Vec3f lightDirection() const { return direction; }
+    // World space to map space: x and y in texels, z the depth compared
+    // against the map
+    inline const Mat4 &worldToMap() const { return toMap; }
+
+    // Farthest depth everywhere, every point is lit
+    void clear();
+    // Add the current level of detail of model, with object to world
+    // transform m, to the map
+    void render(Model *model, const Mat4 &m = Mat4::identity());
+
+    // Depth offset against self shadowing, in world units. The default
+    // covers the depth change across two texels of a 45 degree slope.
+    void setBias(float bias_) { bias = bias_; }
+    // Percentage closer filtering over (2 radius + 1)^2 texels, 0 takes the
+    // nearest texel only
+    void setFilterRadius(int radius) { filterRadius = std::max(radius, 0); }
+
+    // 1 for a lit point, 0 for one in shadow and the fraction of lit texels
+    // in between when filtering. p is in map space.
+    inline float lookup(const Vec3f &p) const
+    {
+        int x = (int)std::floor(p.x + .5f);
+        int y = (int)std::floor(p.y + .5f);
+        float z = p.z + bias;
+        if (!filterRadius)
+            return lit(x, y, z);
+        // Taps further out sit further along a sloped receiver
+        z += bias * filterRadius;
+        int count = 0;
+        for (int dy = -filterRadius; dy <= filterRadius; dy++)
+            for (int dx = -filterRadius; dx <= filterRadius; dx++)
+                count += lit(x + dx, y + dy, z);
+        int side = 2*filterRadius + 1;
+        return count / (float)(side*side);
+    }
+
+    inline int size() const { return depth.get_width(); }
+    const DepthBuffer &depthBuffer() const { return depth; }
+    // Triangles rasterized since the last clear()
+    long triangles() const { return ntriangles; }
+
+    private:
+    DepthBuffer depth;
+    Vec3f direction;
+    Mat4 toMap;
+    float bias;
+    int filterRadius;
+    long ntriangles;
+    std::vector<Vec3f> projected;
+
+    // Outside the map nothing casts a shadow
+    inline bool lit(int x, int y, float z) const
+    {
+        if (x < 0 || y < 0 || x >= depth.get_width() || y >= depth.get_height())
+            return true;
+        return depth.row(y)[x] <= z;
+    }
+};
+
+#endif //__SHADOWMAP_H__
@@ -0,0 +1,253 @@
+#include "simplify.h"
+#include <queue>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Symmetric 4x4 error quadric, upper triangle in row order
+struct Quadric
+{
+    double a[10];
+
+    Quadric() { std::fill(a, a+10, 0.); }
+    // Squared distance to the plane n*p + d = 0 times weight, n normalized
+    Quadric(const Vec3f &n, double d, double weight)
+    {
+        double x = n.x, y = n.y, z = n.z;
+        a[0] = x*x; a[1] = x*y; a[2] = x*z; a[3] = x*d;
+        a[4] = y*y; a[5] = y*z; a[6] = y*d;
+        a[7] = z*z; a[8] = z*d;
+        a[9] = d*d;
+        for (int i = 0; i < 10; i++)
+            a[i] *= weight;
+    }
+
+    Quadric &operator +=(const Quadric &q)
+    {
+        for (int i = 0; i < 10; i++)
+            a[i] += q.a[i];
+        return *this;
+    }
+
+    double error(const Vec3f &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+             + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+             + a[7]*z*z + 2*a[8]*z
+             + a[9];
+    }
+};
+
+// Move vertex from onto vertex to. The stamps are the vertices' versions
+// when the cost was computed, a changed stamp makes the entry stale.
+struct Collapse
+{
+    double cost;
+    uint32_t from, to;
+    unsigned fromStamp, toStamp;
+    // Cheapest first out of std::priority_queue
+    bool operator <(const Collapse &c) const { return cost > c.cost; }
+};
+
+class Simplifier
+{
+    public:
+    Simplifier(const std::vector<Vec3f> &positions_, const std::vector<uint32_t> &indices, const std::vector<char> &locked_)
+        :positions(positions_), locked(locked_), tris(indices), removed(indices.size()/3, 0),
+         vertTris(positions_.size()), quadrics(positions_.size()), stamp(positions_.size(), 0), dead(positions_.size(), 0),
+         alive(indices.size()/3)
+    {
+        for (size_t t = 0; t < removed.size(); t++)
+        {
+            const Vec3f &p0 = positions[tris[3*t]];
+            Vec3f n = cross(positions[tris[3*t+1]] - p0, positions[tris[3*t+2]] - p0);
+            float len = n.norm();
+            // Area weighted so small triangles don't dominate
+            Quadric q;
+            if (len > 0.f)
+            {
+                n = n * (1.f/len);
+                q = Quadric(n, -(n*p0), .5*len);
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                vertTris[tris[3*t+k]].push_back(t);
+                quadrics[tris[3*t+k]] += q;
+            }
+        }
+        for (size_t t = 0; t < removed.size(); t++)
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = tris[3*t+k], b = tris[3*t+(k+1)%3];
+                push(a, b);
+                push(b, a);
+            }
+    }
+
+    size_t triangles() const { return alive; }
+
+    // Do the cheapest valid collapse, false when none is left
+    bool step()
+    {
+        while (!heap.empty())
+        {
+            Collapse c = heap.top();
+            heap.pop();
+            if (dead[c.from] || dead[c.to] || stamp[c.from] != c.fromStamp || stamp[c.to] != c.toStamp)
+                continue;
+            if (!valid(c.from, c.to))
+                continue;
+            collapse(c.from, c.to);
+            return true;
+        }
+        return false;
+    }
+
+    void write(std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        for (size_t t = 0; t < removed.size(); t++)
+            if (!removed[t])
+                out.insert(out.end(), tris.begin() + 3*t, tris.begin() + 3*t + 3);
+    }
+
+    private:
+    const std::vector<Vec3f> &positions;
+    const std::vector<char> &locked;
+    std::vector<uint32_t> tris;
+    std::vector<char> removed;
+    std::vector<std::vector<uint32_t>> vertTris;
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned> stamp;
+    std::vector<char> dead;
+    size_t alive;
+    std::priority_queue<Collapse> heap;
+    std::vector<uint32_t> ringFrom, ringTo;
+
+    bool contains(uint32_t t, uint32_t v) const
+    {
+        return tris[3*t] == v || tris[3*t+1] == v || tris[3*t+2] == v;
+    }
+
+    void push(uint32_t from, uint32_t to)
+    {
+        if (locked[from])
+            return;
+        Quadric q = quadrics[from];
+        q += quadrics[to];
+        heap.push(Collapse{q.error(positions[to]), from, to, stamp[from], stamp[to]});
+    }
+
+    void ring(uint32_t v, std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        for (uint32_t t : vertTris[v])
+            for (int k = 0; k < 3; k++)
+                if (tris[3*t+k] != v)
+                    out.push_back(tris[3*t+k]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // The edge's two end points may only share the vertices opposite the
+    // edge, otherwise the collapse pinches the surface. No remaining
+    // triangle around from may flip or become degenerate.
+    bool valid(uint32_t from, uint32_t to)
+    {
+        int shared = 0;
+        for (uint32_t t : vertTris[from])
+            shared += contains(t, to);
+        if (!shared)
+            return false;
+
+        ring(from, ringFrom);
+        ring(to, ringTo);
+        int common = 0;
+        for (size_t i = 0, j = 0; i < ringFrom.size() && j < ringTo.size(); )
+        {
+            if (ringFrom[i] < ringTo[j]) i++;
+            else if (ringTo[j] < ringFrom[i]) j++;
+            else { common++; i++; j++; }
+        }
+        if (common != shared)
+            return false;
+
+        for (uint32_t t : vertTris[from])
+        {
+            if (contains(t, to))
+                continue;
+            Vec3f p[3], q[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = positions[tris[3*t+k]];
+                q[k] = tris[3*t+k] == from ? positions[to] : p[k];
+            }
+            Vec3f before = cross(p[1] - p[0], p[2] - p[0]);
+            Vec3f after = cross(q[1] - q[0], q[2] - q[0]);
+            float a = after.norm(), b = before.norm();
+            if (a <= 1e-12f || after*before < .2f*a*b)
+                return false;
+        }
+        return true;
+    }
+
+    void collapse(uint32_t from, uint32_t to)
+    {
+        for (uint32_t t : vertTris[from])
+        {
+            if (contains(t, to))
+            {
+                removed[t] = 1;
+                alive--;
+                for (int k = 0; k < 3; k++)
+                {
+                    uint32_t v = tris[3*t+k];
+                    if (v == from)
+                        continue;
+                    auto &list = vertTris[v];
+                    list.erase(std::find(list.begin(), list.end(), t));
+                }
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+                if (tris[3*t+k] == from)
+                    tris[3*t+k] = to;
+            vertTris[to].push_back(t);
+        }
+        vertTris[from].clear();
+        dead[from] = 1;
+        quadrics[to] += quadrics[from];
+
+        // Every entry ending at to is stale now, queue its edges again
+        stamp[to]++;
+        ring(to, ringTo);
+        for (uint32_t n : ringTo)
+        {
+            push(to, n);
+            push(n, to);
+        }
+    }
+};
+
+}
+
+void simplifyMesh(const std::vector<Vec3f> &positions, const std::vector<uint32_t> &indices,
+                  const std::vector<char> &locked, const std::vector<size_t> &targets,
+                  std::vector<std::vector<uint32_t>> &lods)
+{
+    Simplifier simplifier(positions, indices, locked);
+    lods.assign(targets.size(), std::vector<uint32_t>());
+    size_t level = 0;
+    while (level < targets.size())
+    {
+        if (simplifier.triangles() <= targets[level])
+            simplifier.write(lods[level++]);
+        else if (!simplifier.step())
+        {
+            for (; level < targets.size(); level++)
+                simplifier.write(lods[level]);
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "geometry.h"
+
+// Quadric error metric edge collapse (Garland & Heckbert). Vertices are only
+// ever collapsed onto one of their neighbours, so the results index the
+// same vertex arrays as the input. Vertices with locked[v] set never move.
+// Collapses continue until each of targets (decreasing triangle counts) is
+// reached, and the triangles left at that point are written to the matching
+// entry of lods, in their original order. If no valid collapse is left the
+// remaining entries get the last mesh.
+void simplifyMesh(const std::vector<Vec3f> &positions, const std::vector<uint32_t> &indices,
+                  const std::vector<char> &locked, const std::vector<size_t> &targets,
+                  std::vector<std::vector<uint32_t>> &lods);
+
+#endif //__SIMPLIFY_H__
@@ -0,0 +1,1472 @@
+// Self checks and micro benchmarks of the renderer, built as rendertests
+// (make test). Each test renders the model given with --model, the head by
+// default, reports what it measured on stderr and returns whether it
+// passed. Without names every test but the benchmarks runs, the exit status
+// is the number that failed.
+#include <vector>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <iostream>
+#include <fstream>
+#include <sys/stat.h>
+#include "tgaimage.h"
+#include "model.h"
+#include "geometry.h"
+#include "renderer.h"
+#include "depthbuffer.h"
+#include "raster.h"
+#include "shader.h"
+#include "objloader.h"
+#include "scene.h"
+#include "frameloop.h"
+#include "framewriter.h"
+#include "mappedfile.h"
+#include "texturecache.h"
+#include "multisamplebuffer.h"
+#include "shadowmap.h"
+#include "instancebatch.h"
+
+// Heap allocation counter for the allocation tests. Replacing the global
+// operators here keeps them out of the main binary.
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+namespace {
+
+// What every test starts from, filled in from the command line
+struct Fixture
+{
+    std::string obj = "obj/african_head.obj";
+    int frames = 36;        // length of the frame loop test
+    int width = 800;
+    int height = 800;
+    std::vector<std::string> tgaFiles;     // read by the TGA codec benchmark
+
+    std::unique_ptr<Model> loadModel() const { return std::unique_ptr<Model>(new Model(obj.c_str())); }
+    TGAImage image() const { return TGAImage(width, height, TGAImage::RGB); }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double msBetween(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+double msSince(Clock::time_point start)
+{
+    return msBetween(start, Clock::now());
+}
+
+const char *verdict(bool same)
+{
+    return same ? "identical" : "DIFFERENT";
+}
+
+bool identical(TGAImage &a, TGAImage &b)
+{
+    return a.get_width() == b.get_width() && a.get_height() == b.get_height() && a.get_bytespp() == b.get_bytespp()
+        && !memcmp(a.buffer(), b.buffer(), a.get_width()*a.get_height()*a.get_bytespp());
+}
+
+long countDifferences(TGAImage &a, TGAImage &b)
+{
+    long differ = 0;
+    for (int y = 0; y < a.get_height(); y++)
+        for (int x = 0; x < a.get_width(); x++)
+            differ += a.get(x, y).val != b.get(x, y).val;
+    return differ;
+}
+
+inline bool sameRgb(TGAColor a, TGAColor b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+// PSNR in dB over the pixels where neither image shows the background
+double coveredPsnr(TGAImage &a, TGAImage &b, TGAColor background)
+{
+    long covered = 0;
+    double error = 0.;
+    for (int y = 0; y < a.get_height(); y++)
+        for (int x = 0; x < a.get_width(); x++)
+        {
+            TGAColor ca = a.get(x, y), cb = b.get(x, y);
+            if (sameRgb(ca, background) || sameRgb(cb, background))
+                continue;
+            covered++;
+            for (int i = 0; i < 3; i++)
+                error += (ca.raw[i] - cb.raw[i]) * (ca.raw[i] - cb.raw[i]);
+        }
+    return 10. * std::log10(255.*255. / std::max(1e-9, error / (3.*std::max(1L, covered))));
+}
+
+// The post-transform cache runs the vertex stage once per unique vertex of
+// a frame that needs no clipping
+bool testVertexCache(const Fixture &fx)
+{
+    std::unique_ptr<Model> model = fx.loadModel();
+    TGAImage image = fx.image();
+    Renderer r(image, model.get());
+    r.drawModel();
+    const Renderer::VertexCacheStats &stats = r.vertexCacheStats();
+    std::cerr << stats.lookups << " lookups, " << stats.transforms << " transforms, hit rate "
+              << stats.hitRate()*100. << "%" << std::endl;
+    return stats.lookups == model->nfaces()*3 && stats.transforms == model->nverts();
+}
+
+// Face iteration and the vertex path (vertex shader + viewport) must not touch the heap
+bool testVertexAllocations(const Fixture &fx)
+{
+    std::unique_ptr<Model> model = fx.loadModel();
+    TextureModelShader shader(model.get(), Vec3f(-1.f, -1.f, -1.f));
+    Mat4 viewport = Mat4::viewport(fx.width, fx.height, 0, 0);
+
+    size_t before = allocations;
+    Vec3f sum;
+    for (int i=0; i<model->nfaces(); i++) {
+        auto face = model->face(i);
+        for (int j=0; j<3; j++)
+            sum = sum + model->vert(face[j]) + transformPoint(viewport, shader.vertexShader(i, j));
+    }
+    size_t count = allocations - before;
+
+    std::cerr << model->nfaces()*3 << " vertices, " << count << " heap allocations "
+              << (count == 0 ? "OK" : "FAILED") << std::endl;
+    return count == 0;
+}
+
+// Turntable into frames/, written in line and then on the writer thread.
+// The second run over the same buffers must not allocate, and both modes
+// have to write the same files.
+bool testFrameLoop(const Fixture &fx)
+{
+    std::unique_ptr<Model> model = fx.loadModel();
+    mkdir("frames", 0755);
+    int failures = 0;
+    {
+        FrameLoop loop(model.get(), fx.width, fx.height);
+        FrameLoop::CameraPath path = FrameLoop::turntable(Camera());
+        const char *patterns[2] = {"frames/frame%04d.tga", "frames/async%04d.tga"};
+        for (int async = 0; async < 2; async++)
+        {
+            loop.setAsyncWrites(async ? 3 : 0);
+            loop.run(path, fx.frames, patterns[async]);
+
+            size_t before = allocations;
+            bool ok = loop.run(path, fx.frames, patterns[async]);
+            size_t count = allocations - before;
+            failures += !ok || count != 0;
+
+            const FrameLoop::Stats &stats = loop.stats();
+            std::cerr << (async ? "async: " : "sync:  ") << stats.frames << " frames " << (ok ? "written" : "FAILED") << ", "
+                      << stats.fps() << " frames/s, " << stats.renderMs / stats.frames << "ms render, "
+                      << stats.writeMs / stats.frames << "ms write, " << stats.waitMs / stats.frames << "ms wait per frame, "
+                      << count << " heap allocations " << (count == 0 ? "OK" : "FAILED") << std::endl;
+        }
+    }
+
+    int differ = 0;
+    for (int i = 0; i < fx.frames; i++)
+    {
+        char a[64], b[64];
+        snprintf(a, sizeof(a), "frames/frame%04d.tga", i);
+        snprintf(b, sizeof(b), "frames/async%04d.tga", i);
+        MappedFile fa(a), fb(b);
+        differ += fa.size() != fb.size() || memcmp(fa.data(), fb.data(), fa.size());
+    }
+    std::cerr << differ << " of " << fx.frames << " async frames differ" << std::endl;
+    return !failures && !differ;
+}
+
+// Render the model twice with differently configured renderers, true if
+// both images are identical
+template <class A, class B>
+bool compareRenders(const Fixture &fx, const char *nameA, A &&configureA, const char *nameB, B &&configureB)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    TGAImage imageA(width, height, TGAImage::RGB);
+    TGAImage imageB(width, height, TGAImage::RGB);
+
+    long fragmentsA, fragmentsB;
+    auto start = Clock::now();
+    {
+        Renderer r(imageA, model.get());
+        configureA(r);
+        r.drawModel();
+        fragmentsA = r.renderStats().fragments;
+    }
+    auto mid = Clock::now();
+    {
+        Renderer r(imageB, model.get());
+        configureB(r);
+        r.drawModel();
+        fragmentsB = r.renderStats().fragments;
+    }
+    auto end = Clock::now();
+
+    bool same = identical(imageA, imageB);
+    std::cerr << nameA << " " << msBetween(start, mid) << "ms "
+              << fragmentsA << " fragments, "
+              << nameB << " " << msBetween(mid, end) << "ms "
+              << fragmentsB << " fragments, "
+              << verdict(same) << std::endl;
+    return same;
+}
+
+bool testTiledRenderer(const Fixture &fx)
+{
+    return compareRenders(fx, "serial", [](Renderer &) {},
+                              "tiled", [](Renderer &r) { r.setTiledRendering(true); });
+}
+
+bool testSimdRenderer(const Fixture &fx)
+{
+    std::cerr << "simd backend: " << simdBackendName() << std::endl;
+    bool same = compareRenders(fx, "scalar", [](Renderer &) {},
+                                   "simd", [](Renderer &r) { r.setBackend(Renderer::SIMD); });
+    return compareRenders(fx, "scalar", [](Renderer &) {},
+                              "simd tiled", [](Renderer &r) { r.setBackend(Renderer::SIMD); r.setTiledRendering(true, 4, 40); }) && same;
+}
+
+bool testDepthModes(const Fixture &fx)
+{
+    auto late = [](Renderer &r) { r.setDepthMode(Renderer::LATE_Z); };
+    bool same = compareRenders(fx, "late z", late,
+                                   "early z", [](Renderer &r) { r.setDepthMode(Renderer::EARLY_Z); });
+    same = compareRenders(fx, "late z", late,
+                              "deferred", [](Renderer &r) { r.setDepthMode(Renderer::DEFERRED); }) && same;
+    return compareRenders(fx, "late z", late,
+                              "deferred simd tiled", [](Renderer &r) {
+                                  r.setDepthMode(Renderer::DEFERRED);
+                                  r.setBackend(Renderer::SIMD);
+                                  r.setTiledRendering(true, 4, 40);
+                              }) && same;
+}
+
+// Backface culling drops the faces turned away from the camera. The head is
+// not closed around the eyes so a few back faces are visible without it.
+bool testCulling(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    TGAImage reference(width, height, TGAImage::RGB);
+    {
+        Renderer r(reference, model.get());
+        r.drawModel();
+    }
+
+    // Nothing may change without culling, culling the back may only open
+    // the few holes, culling the front has to remove most of the head
+    const char *names[] = {"none", "back", "front"};
+    int failures = 0;
+    for (int mode = Renderer::CULL_NONE; mode <= Renderer::CULL_FRONT; mode++)
+    {
+        TGAImage image(width, height, TGAImage::RGB);
+        Renderer r(image, model.get());
+        r.setCullMode((Renderer::CullMode)mode);
+        r.drawModel();
+
+        long differ = countDifferences(image, reference);
+        const Renderer::RenderStats &stats = r.renderStats();
+        std::cerr << "cull " << names[mode] << ": " << stats.assembled << " of " << stats.triangles
+                  << " triangles rasterized, " << stats.fragments << " fragments, "
+                  << differ << " pixels differ from no culling" << std::endl;
+        if (mode == Renderer::CULL_NONE)
+            failures += differ != 0;
+        else
+            failures += stats.assembled >= stats.triangles;
+    }
+    return !failures;
+}
+
+// A grid of small heads sharing one Model. Drawing the scene with BVH culling
+// has to give the same image as drawing every instance.
+bool testScene(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+    const int grid   = 12;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    Scene scene;
+    for (int i = 0; i < grid; i++)
+        for (int j = 0; j < grid; j++)
+        {
+            Vec3f position((i - grid/2) * .5f, -.3f, (j - grid/2) * .5f);
+            scene.addInstance(model.get(), Mat4::translation(position) * Mat4::scaling(Vec3f(.2f, .2f, .2f)));
+        }
+
+    TGAImage imageA(width, height, TGAImage::RGB);
+    TGAImage imageB(width, height, TGAImage::RGB);
+
+    auto start = Clock::now();
+    {
+        // Everything, in instance order
+        Renderer r(imageA, model.get());
+        for (int i = 0; i < grid*grid; i++)
+        {
+            Vec3f position((i/grid - grid/2) * .5f, -.3f, (i%grid - grid/2) * .5f);
+            r.setModelMatrix(Mat4::translation(position) * Mat4::scaling(Vec3f(.2f, .2f, .2f)));
+            r.drawModel();
+        }
+    }
+    auto mid = Clock::now();
+    {
+        Renderer r(imageB, model.get());
+        scene.draw(r);
+    }
+    auto end = Clock::now();
+
+    const Scene::Stats &stats = scene.stats();
+    bool same = identical(imageA, imageB);
+    std::cerr << "all instances " << msBetween(start, mid) << "ms, scene "
+              << msBetween(mid, end) << "ms, "
+              << stats.visible << " of " << stats.instances << " instances visible, "
+              << stats.nodesVisited << " BVH nodes visited, "
+              << verdict(same) << std::endl;
+
+    imageB.flip_vertically();
+    imageB.write_tga_file("scene.tga");
+    return same;
+}
+
+// Draws a grid of heads from a raised camera with drawInstanced and checks it
+// against one setModelMatrix/drawModel per instance, then times instances
+// that are all culled to get the per instance overhead
+bool testInstanced(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+    const int grid   = 20;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    Camera camera;
+    camera.eye = Vec3f(0.f, 3.f, 5.f);
+    camera.distance = 6.f;
+
+    std::vector<Mat4> transforms;
+    std::vector<TGAColor> tints;
+    for (int i = 0; i < grid; i++)
+        for (int j = 0; j < grid; j++)
+        {
+            Vec3f position((i - grid/2) * .5f, 0.f, (j - grid/2) * .5f);
+            transforms.push_back(Mat4::translation(position) * Mat4::scaling(Vec3f(.2f, .2f, .2f)));
+            tints.push_back(TGAColor(128 + i*6, 128 + j*6, 255 - (i+j)*3, 255));
+        }
+
+    // The batched matrices have to match the scalar ones bit for bit
+    SimpleModelShader shader(model.get());
+    shader.setCamera(camera);
+    InstanceBatch batch;
+    batch.load(transforms.data(), transforms.size());
+    batch.transform(shader.viewProjection());
+    bool sameMatrices = true;
+    for (int lane = 0; lane < InstanceBatch::WIDTH; lane++)
+    {
+        Mat4 mvp = shader.viewProjection() * transforms[lane];
+        Mat4 mvpInvT = mvp.inverse().transpose();
+        Mat4 a = InstanceBatch::get(batch.mvp, lane), b = InstanceBatch::get(batch.mvpInvT, lane);
+        sameMatrices = sameMatrices && !memcmp(&a, &mvp, sizeof(Mat4)) && !memcmp(&b, &mvpInvT, sizeof(Mat4));
+    }
+
+    TGAImage imageA(width, height, TGAImage::RGB);
+    TGAImage imageB(width, height, TGAImage::RGB);
+    auto start = Clock::now();
+    {
+        Renderer r(imageA, model.get());
+        r.setCamera(camera);
+        for (auto &m : transforms)
+        {
+            r.setModelMatrix(m);
+            r.drawModel();
+        }
+    }
+    auto mid = Clock::now();
+    long culled;
+    {
+        Renderer r(imageB, model.get());
+        r.setCamera(camera);
+        r.drawInstanced(transforms.data(), transforms.size());
+        culled = r.renderStats().culledInstances;
+    }
+    auto end = Clock::now();
+
+    bool same = identical(imageA, imageB);
+    std::cerr << "per instance " << msBetween(start, mid) << "ms, instanced "
+              << msBetween(mid, end) << "ms, "
+              << culled << " of " << transforms.size() << " culled, matrices "
+              << verdict(sameMatrices) << ", image " << verdict(same) << std::endl;
+
+    // drawInstanced leaves the model matrix set before it alone
+    bool restored;
+    {
+        Mat4 m = Mat4::scaling(Vec3f(.5f, .5f, .5f));
+        Renderer a(imageA, model.get()), b(imageB, model.get());
+        a.setCamera(camera);
+        b.setCamera(camera);
+        a.setModelMatrix(m);
+        b.setModelMatrix(m);
+        b.drawInstanced(transforms.data(), transforms.size());
+        a.clear();
+        b.clear();
+        a.drawModel();
+        b.drawModel();
+        restored = identical(imageA, imageB);
+        std::cerr << "model matrix after drawInstanced " << verdict(restored) << std::endl;
+    }
+
+    // Everything far off to the side, only the batch work remains
+    const int n = 100000;
+    std::vector<Mat4> hidden(n, Mat4::translation(Vec3f(1000.f, 0.f, 0.f)));
+    {
+        Renderer r(imageB, model.get());
+        r.setCamera(camera);
+        start = Clock::now();
+        r.drawInstanced(hidden.data(), n);
+        end = Clock::now();
+        std::cerr << n << " culled instances " << msBetween(start, end) * 1e6 / n << "ns each" << std::endl;
+    }
+
+    imageB.clear();
+    {
+        Renderer r(imageB, model.get());
+        r.setCamera(camera);
+        r.drawInstanced(transforms.data(), transforms.size(), tints.data());
+    }
+    imageB.flip_vertically();
+    imageB.write_tga_file("instanced.tga");
+    return same && sameMatrices && restored;
+}
+
+// Variable rate shading against full rate deferred shading: fragment shader
+// calls, time and PSNR of the colour. Coverage has to be exactly the same,
+// the PSNR above a floor per rate (34.6 and 23.3 dB at the time of
+// writing), and the tiled renderer has to match the serial one with tiles
+// that cut across the 64 pixel shading regions.
+bool testVariableRate(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+    const TGAColor background(255, 0, 255, 255);
+
+    std::unique_ptr<Model> model = fx.loadModel();
+    model->setTextureFilter(Texture::TRILINEAR);
+
+    auto render = [&](TGAImage &image, Renderer::ShadingRate rate, bool tiled, double &ms, long &fragments) {
+        Renderer r(image, model.get());
+        r.setDepthMode(Renderer::DEFERRED);
+        r.setShadingRate(rate);
+        if (tiled)
+            r.setTiledRendering(true, 4, 40);
+        r.drawModel();
+        r.clear();
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                image.set(x, y, background);
+        auto start = Clock::now();
+        r.drawModel();
+        ms = msSince(start);
+        fragments = r.renderStats().fragments;
+    };
+
+    TGAImage reference(width, height, TGAImage::RGB);
+    double referenceMs;
+    long referenceFragments;
+    render(reference, Renderer::RATE_1X1, false, referenceMs, referenceFragments);
+    std::cerr << "1x1 " << referenceMs << "ms " << referenceFragments << " fragments" << std::endl;
+
+    int failures = 0;
+    for (Renderer::ShadingRate rate : {Renderer::RATE_2X2, Renderer::RATE_4X4})
+    {
+        TGAImage image(width, height, TGAImage::RGB), tiledImage(width, height, TGAImage::RGB);
+        double ms, tiledMs;
+        long fragments, tiledFragments;
+        render(image, rate, false, ms, fragments);
+        render(tiledImage, rate, true, tiledMs, tiledFragments);
+
+        long coverage = 0;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                coverage += sameRgb(reference.get(x, y), background) != sameRgb(image.get(x, y), background);
+        double psnr = coveredPsnr(reference, image, background);
+        bool same = identical(image, tiledImage);
+        double minPsnr = rate == Renderer::RATE_2X2 ? 30. : 20.;
+        failures += coverage != 0 || psnr < minPsnr || !same;
+        std::cerr << rate << "x" << rate << " " << ms << "ms " << fragments << " fragments ("
+                  << (double)referenceFragments/fragments << "x fewer), PSNR " << psnr << " dB, "
+                  << coverage << " coverage differences, tiled " << tiledMs << "ms " << verdict(same) << std::endl;
+        if (rate == Renderer::RATE_4X4)
+        {
+            image.flip_vertically();
+            image.write_tga_file("vrs.tga");
+        }
+    }
+    return !failures;
+}
+
+// Constant white, so a resolved pixel is its coverage
+class CoverageShader : public SimpleModelShader
+{
+public:
+    using SimpleModelShader::SimpleModelShader;
+    virtual TGAColor fragShader(Vec3f) override { return TGAColor(255, 255, 255, 255); }
+    virtual ModelShader* clone() const override { return new CoverageShader(*this); }
+};
+
+// Box filter factor x factor pixel blocks of src into dst
+void downsample(TGAImage &src, TGAImage &dst, int factor)
+{
+    for (int y = 0; y < dst.get_height(); y++)
+        for (int x = 0; x < dst.get_width(); x++)
+        {
+            int sum[3] = {0, 0, 0};
+            for (int j = 0; j < factor; j++)
+                for (int i = 0; i < factor; i++)
+                {
+                    TGAColor c = src.get(x*factor + i, y*factor + j);
+                    for (int k = 0; k < 3; k++)
+                        sum[k] += c.raw[k];
+                }
+            int n = factor*factor;
+            dst.set(x, y, TGAColor((sum[2] + n/2)/n, (sum[1] + n/2)/n, (sum[0] + n/2)/n, 255));
+        }
+}
+
+// MSAA against supersampling. Edge error is the rms difference to the exact
+// coverage of the silhouette, taken on a 16x16 grid per pixel from the same
+// screen space triangles, with a white shader. Ordered 2x2 grid coverage
+// stands in for the edges of 4x supersampling, which renders at twice the
+// resolution and so snaps vertices differently. The cost is measured with
+// the textured shader, the tiled renderer has to resolve to the same image.
+bool testMultisample(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    // Fraction of the offsets covered by any triangle, per pixel
+    std::vector<Vec3f> screen;
+    {
+        SimpleModelShader s(model.get());
+        Mat4 viewport = Mat4::viewport(width, height, 0, 0);
+        for (int i = 0; i < model->nfaces(); i++)
+            for (int j = 0; j < 3; j++)
+            {
+                Vec3f v = transformPoint(viewport, s.vertexShader(i, j));
+                screen.push_back(Vec3f(int(v.x), int(v.y), int(v.z)));
+            }
+    }
+    auto coverage = [&](const std::vector<Vec2i> &offsets) {
+        std::vector<uint32_t> masks(width*height*((offsets.size() + 31)/32), 0);
+        int groups = (offsets.size() + 31)/32;
+        for (int g = 0; g < groups; g++)
+        {
+            int n = std::min<int>(32, offsets.size() - g*32);
+            for (size_t t = 0; t < screen.size(); t += 3)
+                rasterizeMultisample(&screen[t], Vec2i(0, 0), Vec2i(width-1, height-1), &offsets[g*32], n,
+                                     [&](int x, int y, unsigned mask, const float *, const Vec3f &) {
+                    masks[(x + y*width)*groups + g] |= mask;
+                });
+        }
+        std::vector<float> result(width*height);
+        for (int i = 0; i < width*height; i++)
+        {
+            int covered = 0;
+            for (int g = 0; g < groups; g++)
+                covered += __builtin_popcount(masks[i*groups + g]);
+            result[i] = (float)covered / offsets.size();
+        }
+        return result;
+    };
+    std::vector<Vec2i> grid16, grid2 = {Vec2i(-4, -4), Vec2i(4, -4), Vec2i(-4, 4), Vec2i(4, 4)};
+    for (int k = 0; k < 256; k++)
+        grid16.push_back(Vec2i(k % 16 - 8, k / 16 - 8));
+    std::vector<float> truth = coverage(grid16);
+    auto edgeError = [&](auto &&value) {
+        double error = 0.;
+        long edges = 0;
+        for (int i = 0; i < width*height; i++)
+        {
+            float v = value(i);
+            if ((truth[i] == 0.f || truth[i] == 1.f) && v == truth[i])
+                continue;
+            error += (v - truth[i]) * (v - truth[i]);
+            edges++;
+        }
+        return std::sqrt(error / std::max(1L, edges));
+    };
+    std::vector<float> ordered = coverage(grid2);
+    double ssaaError = edgeError([&](int i) { return ordered[i]; });
+
+    struct Config
+    {
+        const char *name;
+        int scale, samples;
+        MultisampleBuffer::Filter filter;
+    };
+    const Config configs[] = {
+        {"no aa", 1, 1, MultisampleBuffer::BOX},
+        {"ssaa 4x", 2, 1, MultisampleBuffer::BOX},
+        {"msaa 4x box", 1, 4, MultisampleBuffer::BOX},
+        {"msaa 4x tent", 1, 4, MultisampleBuffer::TENT},
+        {"msaa 8x box", 1, 8, MultisampleBuffer::BOX},
+    };
+
+    // Renders at scale times the resolution and box filters down to image
+    auto render = [&](const Config &c, TGAImage &image, ModelShader *shader, bool tiled, double &ms, long &fragments) {
+        TGAImage big(width*c.scale, height*c.scale, TGAImage::RGB);
+        TGAImage &target = c.scale > 1 ? big : image;
+        Renderer r(target, model.get());
+        r.setShader(shader);
+        r.setMultisample(c.samples, c.filter);
+        if (tiled)
+            r.setTiledRendering(true);
+        r.drawModel();
+        r.clear();
+        auto start = Clock::now();
+        r.drawModel();
+        if (c.scale > 1)
+            downsample(big, image, c.scale);
+        ms = msSince(start);
+        fragments = r.renderStats().fragments;
+    };
+
+    int failures = 0;
+    double noAaError = 0.;
+    for (const Config &c : configs)
+    {
+        double ms, tiledMs, error = ssaaError;
+        long fragments, tiledFragments;
+        if (c.scale == 1)
+        {
+            TGAImage white(width, height, TGAImage::RGB);
+            render(c, white, new CoverageShader(model.get()), false, ms, fragments);
+            error = edgeError([&](int i) { return white.get(i % width, i / width).raw[0] / 255.f; });
+        }
+
+        TGAImage image(width, height, TGAImage::RGB), tiledImage(width, height, TGAImage::RGB);
+        render(c, image, new TextureModelShader(model.get(), Vec3f(-1.f, -1.f, -1.f)), false, ms, fragments);
+        render(c, tiledImage, new TextureModelShader(model.get(), Vec3f(-1.f, -1.f, -1.f)), true, tiledMs, tiledFragments);
+        bool same = identical(image, tiledImage);
+        failures += !same;
+
+        if (c.samples == 1 && c.scale == 1)
+            noAaError = error;
+        if (c.samples == 4 && c.filter == MultisampleBuffer::BOX)
+        {
+            // Edges close to 4x supersampling
+            failures += error > 1.1*ssaaError || error > .6*noAaError;
+            image.flip_vertically();
+            image.write_tga_file("msaa.tga");
+        }
+        std::cerr << c.name << ": " << ms << "ms, " << fragments << " fragments, edge rms error " << error
+                  << ", tiled " << tiledMs << "ms " << verdict(same) << std::endl;
+    }
+    return !failures;
+}
+
+// Shadows of the head from a light to the upper left. Times the depth only
+// map pass against the main pass and checks it against the generic
+// rasterize() walk. A map with nothing in it has to leave the image as it
+// was, and a light shining from the camera must shadow next to nothing.
+bool testShadows(const Fixture &fx)
+{
+    const int width   = fx.width;
+    const int height  = fx.height;
+    const int mapSize = 1024;
+    const int reps    = 10;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+    model->loadTextures();
+    const Vec3f lightDir(-1.f, -1.f, -1.f);
+
+    // The built in shaders light in view space, the map wants world space
+    Camera camera;
+    Mat4 view = Mat4::camLookAt(camera.up, camera.center, camera.eye);
+    auto toWorld = [&](Vec3f v) { return (view.transpose() * Vec4f(v, 0.f)).xyz(); };
+
+    auto render = [&](TGAImage &image, const ShadowMap *map, double &ms) {
+        Renderer r(image, model.get());
+        r.setShader(new TextureModelShader(model.get(), lightDir));
+        r.setShadowMap(map);
+        r.drawModel();
+        ms = 1e30;
+        for (int i = 0; i < 3; i++)
+        {
+            r.clear();
+            auto start = Clock::now();
+            r.drawModel();
+            ms = std::min(ms, msSince(start));
+        }
+    };
+    // Covered pixels, and those darker than in reference
+    auto darkened = [&](TGAImage &image, TGAImage &reference, long &covered) {
+        long n = 0;
+        covered = 0;
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                TGAColor a = image.get(x, y), b = reference.get(x, y);
+                int sa = a.r + a.g + a.b, sb = b.r + b.g + b.b;
+                covered += sb > 0;
+                n += sa + 8 < sb;
+            }
+        return n;
+    };
+
+    int failures = 0;
+    double mainMs, ms;
+    TGAImage plain(width, height, TGAImage::RGB);
+    render(plain, nullptr, mainMs);
+
+    ShadowMap map(mapSize);
+    map.setLight(toWorld(lightDir), model->boundingSphere());
+    TGAImage empty(width, height, TGAImage::RGB);
+    render(empty, &map, ms);
+    bool same = identical(plain, empty);
+    failures += !same;
+    std::cerr << "main pass " << mainMs << "ms, empty map " << verdict(same) << std::endl;
+
+    // Depth only pass against the same triangles through rasterize()
+    double mapMs = 1e30, genericMs = 1e30;
+    DepthBuffer generic(mapSize, mapSize);
+    for (int i = 0; i < reps; i++)
+    {
+        auto start = Clock::now();
+        map.clear();
+        map.render(model.get());
+        auto mid = Clock::now();
+        generic.clear();
+        for (int f = 0; f < model->nfaces(); f++)
+        {
+            Vec3f pts[3];
+            for (int j = 0; j < 3; j++)
+                pts[j] = transformPoint(map.worldToMap(), model->vert(f, j));
+            rasterize(pts, Vec2i(0, 0), Vec2i(mapSize-1, mapSize-1), [&](int x, int y, const Vec3f &bc) {
+                generic.testAndSet(x, y, pts[0].z*bc.x + pts[1].z*bc.y + pts[2].z*bc.z);
+            });
+        }
+        auto end = Clock::now();
+        mapMs = std::min(mapMs, msBetween(start, mid));
+        genericMs = std::min(genericMs, msBetween(mid, end));
+    }
+    long coverageDiffs = 0;
+    float maxError = 0.f;
+    for (int y = 0; y < mapSize; y++)
+        for (int x = 0; x < mapSize; x++)
+        {
+            float a = map.depthBuffer().get(x, y), b = generic.get(x, y);
+            bool ca = a > -1e30f, cb = b > -1e30f;
+            coverageDiffs += ca != cb;
+            if (ca && cb)
+                maxError = std::max(maxError, std::abs(a - b));
+        }
+    failures += coverageDiffs > 0 || maxError > 1e-4f || mapMs > .5*mainMs;
+    std::cerr << "shadow map " << mapSize << "x" << mapSize << ": " << mapMs << "ms (" << simdBackendName()
+              << "), generic raster " << genericMs << "ms, " << coverageDiffs << " coverage differences, max depth error "
+              << maxError << std::endl;
+
+    for (int radius = 0; radius <= 1; radius++)
+    {
+        map.setFilterRadius(radius);
+        TGAImage image(width, height, TGAImage::RGB);
+        render(image, &map, ms);
+        long covered, shadowed = darkened(image, plain, covered);
+        failures += shadowed == 0 || shadowed > covered/2;
+        std::cerr << (radius ? "pcf 3x3: " : "hard: ") << ms << "ms, " << shadowed << " of " << covered
+                  << " pixels shadowed" << std::endl;
+        if (radius)
+        {
+            image.flip_vertically();
+            image.write_tga_file("shadow.tga");
+        }
+    }
+
+    // Lit from the eye everything visible is lit, what is left is acne and
+    // the difference between the perspective camera and the orthographic light
+    map.setLight(toWorld(Vec3f(0.f, 0.f, -1.f)), model->boundingSphere());
+    map.setFilterRadius(0);
+    map.clear();
+    map.render(model.get());
+    TGAImage headOn(width, height, TGAImage::RGB);
+    render(headOn, &map, ms);
+    long covered, shadowed = darkened(headOn, plain, covered);
+    failures += shadowed > covered/50;
+    std::cerr << "light at the eye: " << shadowed << " of " << covered << " pixels shadowed" << std::endl;
+    return !failures;
+}
+
+// Tangent frames built at load have to be orthonormal, and lighting with the
+// tangent space normal map through them has to come out close to the object
+// space map of the same surface. Times both so the frame costs are visible.
+bool testTangentSpace(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    float maxDot = 0.f, maxLength = 0.f;
+    long mirrored = 0;
+    ArrayView<Vec3f> normals = model->normals();
+    ArrayView<Vec4f> tangents = model->tangents();
+    for (size_t i = 0; i < tangents.size(); i++)
+    {
+        Vec3f t = tangents[i].xyz();
+        maxDot = std::max(maxDot, std::abs(t * normals[i]));
+        maxLength = std::max(maxLength, std::abs(t.norm() - 1.f));
+        mirrored += tangents[i].w < 0.f;
+    }
+    int failures = maxDot > 1e-4f || maxLength > 1e-4f;
+    std::cerr << tangents.size() << " tangents, max |t.n| " << maxDot << ", max ||t|-1| " << maxLength
+              << ", " << mirrored << " mirrored" << std::endl;
+
+    auto render = [&](TGAImage &image, ModelShader *shader, Model::NormalMapSpace space, double &ms) {
+        if (!model->setNormalMapSpace(space))
+            return false;
+        model->loadTextures();
+        Renderer r(image, model.get());
+        r.setShader(shader);
+        r.drawModel();
+        ms = 1e30;
+        for (int i = 0; i < 3; i++)
+        {
+            r.clear();
+            auto start = Clock::now();
+            r.drawModel();
+            ms = std::min(ms, msSince(start));
+        }
+        return true;
+    };
+
+    for (int textured = 0; textured < 2; textured++)
+    {
+        auto makeShader = [&]() -> ModelShader * {
+            if (textured)
+                return new TextureModelShader(model.get(), Vec3f(-1.f, -1.f, -1.f));
+            return new SimpleTextureModelShader(model.get(), Vec3f(-1.f, -1.f, -1.f));
+        };
+        TGAImage object(width, height, TGAImage::RGB), tangent(width, height, TGAImage::RGB);
+        double objectMs, tangentMs;
+        if (!render(object, makeShader(), Model::OBJECT_SPACE, objectMs)
+            || !render(tangent, makeShader(), Model::TANGENT_SPACE, tangentMs))
+        {
+            std::cerr << "the model needs both normal maps" << std::endl;
+            return false;
+        }
+
+        double psnr = coveredPsnr(object, tangent, TGAColor());
+        failures += psnr < 25.;
+        std::cerr << (textured ? "texture" : "simpletexture") << ": object space " << objectMs << "ms, tangent space "
+                  << tangentMs << "ms, PSNR " << psnr << " dB" << std::endl;
+        if (textured)
+        {
+            tangent.flip_vertically();
+            tangent.write_tga_file("tangent.tga");
+        }
+    }
+    return !failures;
+}
+
+// The instance grid of testInstanced with and without levels of detail. The
+// distant heads have to drop to coarser levels, at least halving the
+// triangles rasterized, while the image stays close to the full detail one.
+bool testLod(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+    const int grid   = 20;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+    auto start = Clock::now();
+    model->generateLods();
+    auto end = Clock::now();
+    std::cerr << "lods built in " << msBetween(start, end) << "ms, triangles";
+    for (int i = 0; i < model->nlods(); i++)
+        std::cerr << " " << model->nfaces(i);
+    std::cerr << std::endl;
+
+    Camera camera;
+    camera.eye = Vec3f(0.f, 3.f, 5.f);
+    camera.distance = 6.f;
+    std::vector<Mat4> transforms;
+    for (int i = 0; i < grid; i++)
+        for (int j = 0; j < grid; j++)
+            transforms.push_back(Mat4::translation(Vec3f((i - grid/2) * .5f, 0.f, (j - grid/2) * .5f)) * Mat4::scaling(Vec3f(.2f, .2f, .2f)));
+
+    TGAImage images[2] = {TGAImage(width, height, TGAImage::RGB), TGAImage(width, height, TGAImage::RGB)};
+    long assembled[2];
+    for (int i = 0; i < 2; i++)
+    {
+        Renderer r(images[i], model.get());
+        r.setCamera(camera);
+        r.setLodSelection(i ? 4.f : 0.f);
+        r.drawInstanced(transforms.data(), transforms.size());
+        start = Clock::now();
+        r.clear();
+        r.drawInstanced(transforms.data(), transforms.size());
+        end = Clock::now();
+        const Renderer::RenderStats &stats = r.renderStats();
+        assembled[i] = stats.assembled;
+        std::cerr << (i ? "lod:    " : "no lod: ") << msBetween(start, end) << "ms, "
+                  << stats.triangles << " triangles, " << stats.assembled << " rasterized, " << stats.fragments << " fragments" << std::endl;
+    }
+
+    // The coarser heads may shift the silhouettes by a pixel and move the
+    // specular highlights a little, but must still look like the full detail
+    // ones. At 4 pixels per triangle about 3.6% of the covered pixels change
+    // coverage and the rest come to 20 dB, forcing the coarsest levels
+    // everywhere gives 27% and 9 dB.
+    TGAColor background(0, 0, 0, 255);
+    long covered = 0, coverageDiffers = 0;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            bool a = !sameRgb(images[0].get(x, y), background), b = !sameRgb(images[1].get(x, y), background);
+            covered += a;
+            coverageDiffers += a != b;
+        }
+    double psnr = coveredPsnr(images[0], images[1], background);
+    double coverageShare = (double)coverageDiffers / std::max(1L, covered);
+    std::cerr << countDifferences(images[0], images[1]) << " pixels differ, " << coverageShare*100.
+              << "% of the covered pixels change coverage, " << psnr << " dB PSNR where both are covered" << std::endl;
+
+    images[1].flip_vertically();
+    images[1].write_tga_file("lod.tga");
+    return assembled[1] < assembled[0]/2 && coverageShare < .06 && psnr > 18.;
+}
+
+// Synthetic images with runs of every length around the chunk limits, noise
+// and a rendered frame, in all three pixel formats. The fast codec has to
+// write the same bytes as the stream one and both have to read them back.
+bool testTgaCodec(const Fixture &fx)
+{
+    std::vector<TGAImage> images;
+    for (int bpp : {TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA})
+    {
+        for (int kind = 0; kind < 4; kind++)
+        {
+            TGAImage img(kind == 3 ? 1 : 317, kind == 3 ? 1 : 203, bpp);
+            unsigned char *p = img.buffer();
+            unsigned seed = 1234 + kind;
+            int run = 0, value = 0;
+            for (int i = 0; i < img.get_width()*img.get_height(); i++)
+            {
+                if (--run <= 0)
+                {
+                    seed = seed*1103515245 + 12345;
+                    // Run lengths 1..300 for kind 1, single pixels for 2
+                    run = kind == 1 ? (seed >> 16) % 300 + 1 : (kind == 2 ? 1 : 1000000);
+                    value = seed >> 8;
+                }
+                for (int b = 0; b < bpp; b++)
+                    p[i*bpp + b] = kind == 2 ? (value >> (b*3)) & 3 : value >> (b*8);
+            }
+            images.push_back(img);
+        }
+    }
+    TGAImage frame = fx.image();
+    std::unique_ptr<Model> model = fx.loadModel();
+    Renderer(frame, model.get()).drawModel();
+    images.push_back(frame);
+
+    int failures = 0;
+    for (auto &img : images)
+    {
+        size_t nbytes = img.get_width()*img.get_height()*img.get_bytespp();
+        for (bool rle : {true, false})
+        {
+            img.write_tga_file_stream("bench_output.tga", rle);
+            MappedFile reference("bench_output.tga");
+            std::vector<unsigned char> encoded;
+            img.encode_tga(encoded, rle);
+            bool sameBytes = reference.size() == encoded.size() && !memcmp(reference.data(), encoded.data(), encoded.size());
+
+            TGAImage decoded, streamDecoded;
+            decoded.decode_tga(encoded.data(), encoded.size());
+            streamDecoded.read_tga_file_stream("bench_output.tga");
+            bool roundTrip = decoded.buffer() && !memcmp(decoded.buffer(), img.buffer(), nbytes)
+                          && streamDecoded.buffer() && !memcmp(streamDecoded.buffer(), img.buffer(), nbytes);
+            failures += !sameBytes || !roundTrip;
+        }
+    }
+    remove("bench_output.tga");
+    std::cerr << images.size()*2 << " images encoded and decoded, " << failures << " failures" << std::endl;
+    return !failures;
+}
+
+// Read and write throughput of the stream and the in memory TGA codec
+bool benchTgaCodec(const Fixture &fx)
+{
+    const int runs = 10;
+    std::vector<std::string> files = fx.tgaFiles;
+    if (files.empty())
+        files = {"obj/african_head_nm.tga", "obj/african_head_diffuse.tga", "output.tga"};
+
+    auto median = [](std::vector<double> v) { std::sort(v.begin(), v.end()); return v[v.size()/2]; };
+    auto time = [&](auto &&f) {
+        std::vector<double> ms;
+        for (int i = 0; i < runs; i++)
+        {
+            auto start = Clock::now();
+            f();
+            ms.push_back(msSince(start));
+        }
+        return median(ms);
+    };
+
+    std::cerr.setstate(std::ios::failbit);
+    for (const std::string &name : files)
+    {
+        const char *file = name.c_str();
+        TGAImage img;
+        if (!img.read_tga_file(file))
+            continue;
+        double mb = img.get_width()*img.get_height()*img.get_bytespp() / 1e6;
+        TGAImage tmp;
+        double readStream = time([&] { tmp.read_tga_file_stream(file); });
+        double readFast = time([&] { tmp.read_tga_file(file); });
+        double writeStream = time([&] { img.write_tga_file_stream("bench_output.tga"); });
+        double writeFast = time([&] { img.write_tga_file("bench_output.tga"); });
+        std::vector<unsigned char> encoded;
+        double encode = time([&] { img.encode_tga(encoded); });
+        double decode = time([&] { tmp.decode_tga(encoded.data(), encoded.size()); });
+        printf("%-30s %6.2f MB  read %7.1f -> %7.1f MB/s  write %7.1f -> %7.1f MB/s  encode %7.1f MB/s  decode %7.1f MB/s\n",
+               file, mb, mb/readStream*1000., mb/readFast*1000., mb/writeStream*1000., mb/writeFast*1000.,
+               mb/encode*1000., mb/decode*1000.);
+    }
+    std::cerr.clear();
+    remove("bench_output.tga");
+    return true;
+}
+
+// Textures from the cache match the ones decoded through TGAImage, two
+// models of the same mesh share their maps and unused maps get evicted
+bool testTextureCache(const Fixture &fx)
+{
+    const char *obj = fx.obj.c_str();
+    TextureCache &cache = TextureCache::instance();
+    int failures = 0;
+
+    auto same = [](const Texture &a, const Texture &b) {
+        if (a.nlevels() != b.nlevels() || a.get_bytespp() != b.get_bytespp())
+            return false;
+        for (int l = 0; l < a.nlevels(); l++)
+        {
+            int w = std::max(1, a.get_width() >> l), h = std::max(1, a.get_height() >> l);
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    if (a.get(x, y, l).val != b.get(x, y, l).val)
+                        return false;
+        }
+        return true;
+    };
+    auto reference = [](const char *file) {
+        TGAImage img;
+        img.read_tga_file(file);
+        img.flip_vertically();
+        return Texture(img);
+    };
+
+    std::cerr.setstate(std::ios::failbit);
+    std::vector<std::string> files;
+    std::string base(obj);
+    base = base.substr(0, base.find_last_of("."));
+    for (const char *suffix : {"_diffuse.tga", "_nm.tga", "_nm_tangent.tga", "_spec.tga"})
+        files.push_back(base + suffix);
+    // Every format in both row orders
+    unsigned seed = 1;
+    for (int bpp : {1, 3, 4})
+        for (bool rle : {true, false})
+            for (bool bottomUp : {true, false})
+            {
+                TGAImage img(37, 21, bpp);
+                unsigned char *p = img.buffer();
+                for (int i = 0; i < 37*21*bpp; i++)
+                {
+                    seed = seed*1103515245 + 12345;
+                    p[i] = seed >> 16;
+                }
+                std::vector<unsigned char> encoded;
+                img.encode_tga(encoded, rle, bottomUp);
+                files.push_back("texcache" + std::to_string(files.size()) + ".tga");
+                FrameWriter::writeFile(files.back().c_str(), encoded);
+            }
+    for (auto &file : files)
+        failures += !same(*cache.load(file), reference(file.c_str()));
+    std::cerr.clear();
+    for (size_t i = 4; i < files.size(); i++)
+        remove(files[i].c_str());
+    cache.clear();
+    std::cerr << files.size() << " textures compared with TGAImage decoding, " << failures << " differ" << std::endl;
+
+    TextureCache::Stats before = cache.stats();
+    auto start = Clock::now();
+    Model *a = new Model(obj);
+    double openMs = msSince(start);
+    bool lazy = cache.stats().misses == before.misses && !cache.bytes();
+    start = Clock::now();
+    a->loadTextures();
+    double decodeMs = msSince(start);
+    start = Clock::now();
+    Model *b = new Model(obj);
+    b->loadTextures();
+    double secondMs = msSince(start);
+    TextureCache::Stats after = cache.stats();
+    size_t shared = cache.bytes();
+    bool sharing = after.misses - before.misses == 3 && after.hits - before.hits == 3;
+    failures += !lazy + !sharing;
+    std::cerr << "first model " << openMs << " ms + " << decodeMs << " ms decoding, second model " << secondMs << " ms, "
+              << shared/1048576. << " MB of textures " << (lazy && sharing ? "shared" : "NOT SHARED") << std::endl;
+
+    // Nothing can go while the models hold their maps
+    cache.setBudget(0);
+    bool kept = cache.bytes() == shared;
+    delete a;
+    delete b;
+    cache.setBudget(1);
+    bool evicted = !cache.bytes() && cache.stats().evictions - after.evictions == 3;
+    cache.setBudget(256u << 20);
+    failures += !kept + !evicted;
+    std::cerr << "eviction " << (kept && evicted ? "OK" : "FAILED") << std::endl;
+    return !failures;
+}
+
+// Draw the model three times over itself with and without hierarchical Z.
+// The later draws are hidden almost entirely so most of them is rejected.
+bool testHierarchicalZ(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    // Every mode draws the same triangles in the same order, so the tiled
+    // ones have to reject as many triangles as the serial ones
+    int failures = 0;
+    long rejected = -1;
+    auto check = [&](const char *name, void (*configure)(Renderer &)) {
+        TGAImage imageA(width, height, TGAImage::RGB);
+        TGAImage imageB(width, height, TGAImage::RGB);
+        Renderer a(imageA, model.get());
+        Renderer b(imageB, model.get());
+        configure(a);
+        configure(b);
+        b.setHierarchicalZ(true);
+
+        auto start = Clock::now();
+        for (int i = 0; i < 3; i++)
+            a.drawModel();
+        auto mid = Clock::now();
+        long triangles = 0, tiles = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            b.drawModel();
+            triangles += b.renderStats().rejectedTriangles;
+            tiles += b.renderStats().rejectedTiles;
+        }
+        auto end = Clock::now();
+
+        bool same = identical(imageA, imageB);
+        std::cerr << name << ": " << msBetween(start, mid) << "ms, hiz "
+                  << msBetween(mid, end) << "ms, "
+                  << triangles << " triangles and " << tiles << " tiles rejected, "
+                  << verdict(same) << std::endl;
+        if (rejected < 0)
+            rejected = triangles;
+        failures += !same || !triangles || triangles != rejected;
+    };
+
+    check("early z", [](Renderer &) {});
+    check("late z", [](Renderer &r) { r.setDepthMode(Renderer::LATE_Z); });
+    check("deferred", [](Renderer &r) { r.setDepthMode(Renderer::DEFERRED); });
+    check("simd", [](Renderer &r) { r.setBackend(Renderer::SIMD); });
+    check("simd tiled", [](Renderer &r) { r.setBackend(Renderer::SIMD); r.setTiledRendering(true, 4, 40); });
+    check("deferred tiled", [](Renderer &r) { r.setDepthMode(Renderer::DEFERRED); r.setTiledRendering(true, 4, 40); });
+    return !failures;
+}
+
+// Depth test throughput of the old vector<vector<float>> zbuffer against
+// DepthBuffer in its three formats. The fragments of the head are generated
+// once through rasterize(), so the timed loops only read and write depth.
+// The old buffer is indexed [x][y] and gets them in column order, walking
+// each triangle x outer like the loop it was written for, DepthBuffer gets
+// them in scanline order.
+bool benchDepthBuffer(const Fixture &fx)
+{
+    const int width  = fx.width;
+    const int height = fx.height;
+    const int frames = 50;
+
+    std::unique_ptr<Model> model = fx.loadModel();
+
+    struct Fragment
+    {
+        int x, y;
+        float z;
+    };
+    std::vector<Fragment> rows, columns;
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        Vec3f pts[3];
+        for (int j = 0; j < 3; j++)
+        {
+            Vec3f v = model->vert(i, j);
+            pts[j] = Vec3f(int((v.x+1.)*width/2.), int((v.y+1.)*height/2.), (v.z+1.)*127.5);
+        }
+        size_t first = rows.size();
+        rasterize(pts, Vec2i(0, 0), Vec2i(width-1, height-1), [&](int x, int y, const Vec3f &bc) {
+            rows.push_back({x, y, pts[0].z*bc.x + pts[1].z*bc.y + pts[2].z*bc.z});
+        });
+        columns.insert(columns.end(), rows.begin() + first, rows.end());
+        std::stable_sort(columns.begin() + first, columns.end(),
+                         [](const Fragment &a, const Fragment &b) { return a.x < b.x; });
+    }
+
+    auto run = [&](const char *name, const std::vector<Fragment> &fragments, auto &&clear, auto &&test) {
+        auto start = Clock::now();
+        for (int f = 0; f < frames; f++)
+        {
+            clear();
+            for (const Fragment &p : fragments)
+                test(p.x, p.y, p.z);
+        }
+        double ms = msSince(start);
+        std::cerr << name << ": " << ms/frames << "ms/frame, "
+                  << fragments.size()*frames/ms/1000. << " Mfragments/s" << std::endl;
+    };
+
+    std::cerr << rows.size() << " fragments per frame" << std::endl;
+    std::vector<std::vector<float>> old(width, std::vector<float>(height));
+    run("vector<vector<float>>", columns, [&] {
+        for (auto &column : old)
+            for (auto &d : column)
+                d = -std::numeric_limits<float>::max();
+    }, [&](int x, int y, float z) {
+        if (old[x][y] < z) old[x][y] = z;
+    });
+
+    // Both walks see the same fragments, so the closest depths must agree
+    int differ = 0;
+    const char *names[] = {"DepthBuffer FLOAT32", "DepthBuffer UNORM16", "DepthBuffer UNORM24"};
+    for (int format = DepthBuffer::FLOAT32; format <= DepthBuffer::UNORM24; format++)
+    {
+        DepthBuffer zbuf(width, height, (DepthBuffer::Format)format);
+        run(names[format], rows, [&] { zbuf.clear(); }, [&](int x, int y, float z) { zbuf.testAndSet(x, y, z); });
+        if (format == DepthBuffer::FLOAT32)
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++)
+                    differ += old[x][y] > -std::numeric_limits<float>::max() && old[x][y] != zbuf.get(x, y);
+    }
+    std::cerr << differ << " depths differ" << std::endl;
+    return !differ;
+}
+
+// OBJ load time of the original stream parser, the mmap parser serial and
+// threaded, and the binary mesh cache. Meshes must come out identical.
+bool benchObjLoader(const Fixture &fx)
+{
+    const char *filename = fx.obj.c_str();
+    const int runs = 20;
+    int nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+    ObjMesh reference;
+    if (!loadObjStream(filename, reference)) {
+        std::cerr << "can't load " << filename << std::endl;
+        return false;
+    }
+    std::string cachefile = std::string(filename) + ".meshcache";
+    writeMeshCache(cachefile.c_str(), filename, reference);
+
+    auto same = [&](const ObjMesh &m) {
+        auto eq = [](const auto &a, const auto &b) {
+            return a.size() == b.size() && !memcmp((const void *)a.data(), (const void *)b.data(), a.size()*sizeof(a[0]));
+        };
+        return eq(m.verts, reference.verts) && eq(m.uvs, reference.uvs) && eq(m.norms, reference.norms) &&
+               eq(m.corners, reference.corners) && eq(m.faceStart, reference.faceStart);
+    };
+
+    int failures = 0;
+    auto run = [&](const char *name, auto &&load) {
+        ObjMesh mesh;
+        auto start = Clock::now();
+        for (int i = 0; i < runs; i++)
+            load(mesh);
+        double ms = msSince(start);
+        failures += !same(mesh);
+        std::cerr << name << ": " << ms/runs << "ms " << verdict(same(mesh)) << std::endl;
+    };
+
+    run("istringstream", [&](ObjMesh &m) { loadObjStream(filename, m); });
+    run("mmap", [&](ObjMesh &m) { loadObj(filename, m, 1); });
+    run("mmap threaded", [&](ObjMesh &m) { loadObj(filename, m, nthreads); });
+    run("mesh cache", [&](ObjMesh &m) { readMeshCache(cachefile.c_str(), filename, m); });
+    remove(cachefile.c_str());
+    return !failures;
+}
+
+// Face indices outside the elements defined so far fail the load, serial and
+// with the file split into chunks, rather than reading past the arrays
+bool testObjIndices(const Fixture &)
+{
+    const char *filename = "objindices.obj";
+    // Enough vertices for several 1MB chunks, the faces land in the last one
+    std::string vertices;
+    for (int i = 0; i < 300000; i++)
+        vertices += "v 0.5 0.25 0.125\nvt 0.5 0.5\n";
+    const struct { const char *face; bool valid; } cases[] = {
+        {"f 1/1 2/2 3/3\n",                     true},
+        {"f -1/-1 -2/-2 -300000/-300000\n",     true},
+        {"f 300000/1 1/1 2/2\n",                true},
+        {"f 0/1 1/1 2/2\n",                     false},
+        {"f 1/1 2/2 300001/3\n",                false},
+        {"f -1/-1 -2/-2 -300001/-3\n",          false},
+        {"f 1/1 2/2 3/300001\n",                false},
+    };
+
+    int failures = 0;
+    for (const auto &c : cases)
+    {
+        {
+            std::ofstream out(filename, std::ios::binary);
+            out << vertices << c.face;
+        }
+        for (int nthreads : {1, 4})
+        {
+            ObjMesh mesh;
+            bool loaded = loadObj(filename, mesh, nthreads);
+            bool ok = loaded == c.valid && (!loaded || mesh.nfaces() == 1);
+            failures += !ok;
+            std::cerr << std::string(c.face, strlen(c.face) - 1) << ", " << nthreads << " threads: "
+                      << (loaded ? "loaded " : "rejected ") << (ok ? "OK" : "FAILED") << std::endl;
+        }
+    }
+    remove(filename);
+    return !failures;
+}
+
+struct Test
+{
+    const char *name;
+    bool (*run)(const Fixture &);
+    bool benchmark;     // only run when named
+};
+
+const Test tests[] = {
+    {"tiled",       testTiledRenderer,     false},
+    {"bench-zbuf",  benchDepthBuffer,      true},
+    {"simd",        testSimdRenderer,      false},
+    {"depth",       testDepthModes,        false},
+    {"cull",        testCulling,           false},
+    {"scene",       testScene,             false},
+    {"instanced",   testInstanced,         false},
+    {"lod",         testLod,               false},
+    {"tga",         testTgaCodec,          false},
+    {"bench-tga",   benchTgaCodec,         true},
+    {"texcache",    testTextureCache,      false},
+    {"hiz",         testHierarchicalZ,     false},
+    {"vrs",         testVariableRate,      false},
+    {"msaa",        testMultisample,       false},
+    {"shadow",      testShadows,           false},
+    {"tangent",     testTangentSpace,      false},
+    {"bench-obj",   benchObjLoader,        true},
+    {"objindex",    testObjIndices,        false},
+    {"vcache",      testVertexCache,       false},
+    {"alloc",       testVertexAllocations, false},
+    {"frames",      testFrameLoop,         false},
+};
+
+void usage()
+{
+    std::cerr << "usage: rendertests [options] [test..]\n"
+                 "  --model FILE    model to render, default obj/african_head.obj\n"
+                 "  --frames N      frames of the frame loop test, default 36\n"
+                 "  --tga FILE      image for the TGA codec benchmark, repeatable\n"
+                 "tests:";
+    for (const Test &t : tests)
+        std::cerr << " " << t.name << (t.benchmark ? "*" : "");
+    std::cerr << "\n  (* benchmark, only run when named)" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Fixture fx;
+    std::vector<const Test *> selected;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if (arg == "--model" && hasValue)
+            fx.obj = argv[++i];
+        else if (arg == "--frames" && hasValue)
+            fx.frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--tga" && hasValue)
+            fx.tgaFiles.push_back(argv[++i]);
+        else
+        {
+            const Test *found = nullptr;
+            for (const Test &t : tests)
+                if (arg == t.name)
+                    found = &t;
+            if (!found)
+            {
+                usage();
+                return 2;
+            }
+            selected.push_back(found);
+        }
+    }
+    if (selected.empty())
+        for (const Test &t : tests)
+            if (!t.benchmark)
+                selected.push_back(&t);
+
+    int failures = 0;
+    for (const Test *t : selected)
+    {
+        std::cerr << "== " << t->name << std::endl;
+        bool ok = t->run(fx);
+        failures += !ok;
+        std::cerr << t->name << (ok ? " passed" : " FAILED") << std::endl;
+    }
+    return failures;
+}
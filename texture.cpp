@@ -0,0 +1,152 @@
+#include "texture.h"
+#include <cstring>
+#include <algorithm>
+
+// Per channel linear blend of two BGRA words, t in [0, 256]
+static inline uint32_t lerp(uint32_t a, uint32_t b, int t)
+{
+    // Red/blue and green/alpha pairs in parallel, 8 bits of headroom each
+    uint32_t rb = (((a & 0x00ff00ff) * (256 - t) + (b & 0x00ff00ff) * t) >> 8) & 0x00ff00ff;
+    uint32_t ga = ((((a >> 8) & 0x00ff00ff) * (256 - t) + ((b >> 8) & 0x00ff00ff) * t) >> 8) & 0x00ff00ff;
+    return rb | (ga << 8);
+}
+
+void Texture::Level::resize(int w, int h)
+{
+    width = w;
+    height = h;
+    tilesX = (w + 7) / 8;
+    int tilesY = (h + 7) / 8;
+    texels.assign((size_t)tilesX * tilesY * 64, 0);
+}
+
+Texture::Texture()
+    :bytespp(0)
+{
+}
+
+Texture::Texture(TGAImage &img)
+    :Texture()
+{
+    load(img);
+}
+
+void Texture::load(TGAImage &img)
+{
+    int bpp = img.get_bytespp();
+    load(img.buffer(), img.get_width(), img.get_height(), bpp, bpp, (ptrdiff_t)img.get_width()*bpp);
+}
+
+void Texture::load(const unsigned char *origin, int w, int h, int bpp, ptrdiff_t pixelStride, ptrdiff_t rowStride)
+{
+    levels.clear();
+    bytespp = bpp;
+    if (!origin || w <= 0 || h <= 0)
+        return;
+
+    Level base;
+    base.resize(w, h);
+    for (int y = 0; y < h; y++)
+    {
+        const unsigned char *row = origin + y*rowStride;
+        for (int x = 0; x < w; x++)
+        {
+            uint32_t v = 0;
+            memcpy(&v, row + x*pixelStride, bytespp);
+            base.store(x, y, v);
+        }
+    }
+    levels.push_back(std::move(base));
+
+    // Box filtered mip chain down to 1x1
+    while (w > 1 || h > 1)
+    {
+        const Level &src = levels.back();
+        Level dst;
+        dst.resize(std::max(1, w/2), std::max(1, h/2));
+        for (int y = 0; y < dst.height; y++)
+            for (int x = 0; x < dst.width; x++)
+            {
+                uint32_t a = src.fetch(2*x, 2*y),   b = src.fetch(2*x+1, 2*y);
+                uint32_t c = src.fetch(2*x, 2*y+1), d = src.fetch(2*x+1, 2*y+1);
+                uint32_t v = 0;
+                for (int i = 0; i < 32; i += 8)
+                {
+                    uint32_t sum = ((a >> i) & 0xff) + ((b >> i) & 0xff) + ((c >> i) & 0xff) + ((d >> i) & 0xff);
+                    v |= ((sum + 2) / 4) << i;
+                }
+                dst.store(x, y, v);
+            }
+        w = dst.width;
+        h = dst.height;
+        levels.push_back(std::move(dst));
+    }
+}
+
+size_t Texture::bytes() const
+{
+    size_t n = 0;
+    for (const Level &l : levels)
+        n += l.texels.size()*sizeof(uint32_t);
+    return n;
+}
+
+TGAColor Texture::get(int x, int y, int level) const
+{
+    if (empty())
+        return TGAColor();
+    return TGAColor(levels[level].fetch(x, y), bytespp);
+}
+
+float Texture::lod(const UvGradient &g) const
+{
+    if (empty())
+        return 0.f;
+    float w = levels[0].width;
+    float h = levels[0].height;
+    float dx = g.dx.x*w*g.dx.x*w + g.dx.y*h*g.dx.y*h;
+    float dy = g.dy.x*w*g.dy.x*w + g.dy.y*h*g.dy.y*h;
+    // log2 of the longer footprint axis, sqrt folded into the 0.5 factor
+    float rho2 = std::max(dx, dy);
+    return rho2 > 1.f ? 0.5f * std::log2(rho2) : 0.f;
+}
+
+uint32_t Texture::nearest(const Level &l, Vec2f uv) const
+{
+    return l.fetch(int(uv.x*l.width), int(uv.y*l.height));
+}
+
+uint32_t Texture::bilinear(const Level &l, Vec2f uv) const
+{
+    float fx = uv.x*l.width - .5f;
+    float fy = uv.y*l.height - .5f;
+    int x = (int)std::floor(fx);
+    int y = (int)std::floor(fy);
+    int tx = (int)((fx - x) * 256.f);
+    int ty = (int)((fy - y) * 256.f);
+    uint32_t top = lerp(l.fetch(x, y), l.fetch(x+1, y), tx);
+    uint32_t bottom = lerp(l.fetch(x, y+1), l.fetch(x+1, y+1), tx);
+    return lerp(top, bottom, ty);
+}
+
+TGAColor Texture::sample(Vec2f uv, float lod, Filter filter) const
+{
+    if (empty())
+        return TGAColor();
+
+    float maxLevel = levels.size() - 1;
+    lod = std::min(std::max(lod, 0.f), maxLevel);
+
+    if (filter == TRILINEAR)
+    {
+        int level = (int)lod;
+        int t = (int)((lod - level) * 256.f);
+        uint32_t a = bilinear(levels[level], uv);
+        if (!t || level == maxLevel)
+            return TGAColor(a, bytespp);
+        return TGAColor(lerp(a, bilinear(levels[level+1], uv), t), bytespp);
+    }
+
+    const Level &l = levels[(int)(lod + .5f)];
+    return TGAColor(filter == NEAREST ? nearest(l, uv) : bilinear(l, uv), bytespp);
+}
@@ -0,0 +1,87 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Screen space derivatives of the texture coordinates, per pixel step in x and y
+struct UvGradient
+{
+    Vec2f dx, dy;
+};
+
+// Mipmapped texture. Every level is stored in 8x8 texel tiles with the texels
+// of a tile in Morton order, so a filter footprint touches one or two cache
+// lines instead of one per scanline. Texels are kept as 32 bit BGRA words.
+class Texture
+{
+    public:
+    enum Filter {
+        NEAREST, BILINEAR, TRILINEAR
+    };
+
+    Texture();
+    // Builds the full mip chain from img
+    Texture(TGAImage &img);
+    void load(TGAImage &img);
+    // Builds the mip chain from pixels the texture doesn't own. origin is
+    // texel (0, 0) and the strides in bytes may be negative, so rows stored
+    // in the opposite order are read in place instead of flipped first.
+    void load(const unsigned char *origin, int w, int h, int bytespp, ptrdiff_t pixelStride, ptrdiff_t rowStride);
+
+    bool empty() const { return levels.empty(); }
+    int get_width() const { return empty() ? 0 : levels[0].width; }
+    int get_height() const { return empty() ? 0 : levels[0].height; }
+    int get_bytespp() const { return bytespp; }
+    int nlevels() const { return levels.size(); }
+    // Memory held by all the levels
+    size_t bytes() const;
+
+    // Texel of a level, coordinates are clamped to the edge
+    TGAColor get(int x, int y, int level = 0) const;
+
+    // Level of detail (log2 of texels per pixel) for the given uv derivatives
+    float lod(const UvGradient &g) const;
+
+    // Sample at uv from the level picked by lod. NEAREST and BILINEAR use
+    // the nearest level, TRILINEAR blends the two closest.
+    TGAColor sample(Vec2f uv, float lod, Filter filter) const;
+
+    private:
+    struct Level
+    {
+        int width, height;
+        int tilesX;
+        std::vector<uint32_t> texels;
+
+        inline uint32_t fetch(int x, int y) const
+        {
+            x = x < 0 ? 0 : (x >= width ? width-1 : x);
+            y = y < 0 ? 0 : (y >= height ? height-1 : y);
+            return texels[((y >> 3)*tilesX + (x >> 3))*64 + morton(x & 7, y & 7)];
+        }
+        inline void store(int x, int y, uint32_t v)
+        {
+            texels[((y >> 3)*tilesX + (x >> 3))*64 + morton(x & 7, y & 7)] = v;
+        }
+        void resize(int w, int h);
+    };
+
+    std::vector<Level> levels;
+    int bytespp;
+
+    // Interleave the bits of two 3 bit coordinates
+    static inline int morton(int x, int y)
+    {
+        auto spread = [](int v) { return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2); };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    uint32_t nearest(const Level &l, Vec2f uv) const;
+    uint32_t bilinear(const Level &l, Vec2f uv) const;
+};
+
+#endif //__TEXTURE_H__
@@ -0,0 +1,177 @@
+#include "texturecache.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "mappedfile.h"
+
+namespace {
+
+// Header fields the cache needs, false for anything decode_tga would reject
+bool parseHeader(const MappedFile &file, TGA_Header &header)
+{
+    if (!file.is_open() || file.size() < sizeof(header))
+        return false;
+    memcpy((void *)&header, file.data(), sizeof(header));
+    int bpp = header.bitsperpixel>>3;
+    int type = header.datatypecode;
+    return header.width > 0 && header.height > 0
+        && (bpp == TGAImage::GRAYSCALE || bpp == TGAImage::RGB || bpp == TGAImage::RGBA)
+        && (type == 2 || type == 3 || type == 10 || type == 11);
+}
+
+// Texel (0, 0) is the bottom left corner, the same as TGAImage after
+// read_tga_file and flip_vertically
+void loadOriented(Texture &tex, const unsigned char *pixels, const TGA_Header &header)
+{
+    int w = header.width, h = header.height, bpp = header.bitsperpixel>>3;
+    ptrdiff_t pixelStride = bpp, rowStride = (ptrdiff_t)w*bpp;
+    const unsigned char *origin = pixels;
+    if (header.imagedescriptor & 0x20)
+    {
+        origin += (h-1)*rowStride;
+        rowStride = -rowStride;
+    }
+    if (header.imagedescriptor & 0x10)
+    {
+        origin += (w-1)*pixelStride;
+        pixelStride = -pixelStride;
+    }
+    tex.load(origin, w, h, bpp, pixelStride, rowStride);
+}
+
+}
+
+TextureCache &TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+TextureCache::TextureCache()
+    :budget_(256u << 20), bytes_(0), clock(0), stats_{0, 0, 0}
+{
+}
+
+void TextureCache::Handle::resolve()
+{
+    static const std::shared_ptr<const Texture> none = std::make_shared<Texture>();
+    texture = path.empty() ? none : TextureCache::instance().load(path);
+}
+
+TextureCache::Handle TextureCache::open(const std::string &path, bool *ok)
+{
+    Handle handle;
+    bool known;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        known = entries.count(path) != 0;
+    }
+    TGA_Header header;
+    if (known || parseHeader(MappedFile(path.c_str()), header))
+        handle.path = path;
+    if (ok)
+        *ok = !handle.path.empty();
+    return handle;
+}
+
+std::shared_ptr<const Texture> TextureCache::load(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(path);
+        if (it != entries.end())
+        {
+            stats_.hits++;
+            it->second.lastUse = ++clock;
+            return it->second.texture;
+        }
+    }
+
+    // Decode without the lock, if someone else got there first use theirs
+    std::shared_ptr<const Texture> texture = decode(path);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.emplace(path, Entry{texture, 0});
+    if (it.second)
+    {
+        stats_.misses++;
+        bytes_ += texture->bytes();
+    }
+    else
+        stats_.hits++;
+    it.first->second.lastUse = ++clock;
+    std::shared_ptr<const Texture> result = it.first->second.texture;
+    evict(budget_);
+    return result;
+}
+
+std::shared_ptr<const Texture> TextureCache::decode(const std::string &path)
+{
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+    MappedFile file(path.c_str());
+    TGA_Header header;
+    if (!parseHeader(file, header))
+        return texture;
+
+    const unsigned char *data = (const unsigned char *)file.data();
+    size_t pos = sizeof(header) + (unsigned char)header.idlength;
+    if (header.colormaptype)
+        pos += (size_t)(unsigned short)header.colormaplength * (((unsigned char)header.colormapdepth + 7) >> 3);
+    size_t nbytes = (size_t)header.width*header.height*(header.bitsperpixel>>3);
+
+    if (header.datatypecode == 2 || header.datatypecode == 3)
+    {
+        if (pos <= file.size() && file.size() - pos >= nbytes)
+            loadOriented(*texture, data + pos, header);
+    }
+    else
+    {
+        TGAImage img;
+        if (img.decode_tga(data, file.size(), false))
+            loadOriented(*texture, img.buffer(), header);
+    }
+    return texture;
+}
+
+void TextureCache::evict(size_t budget)
+{
+    while (bytes_ > budget)
+    {
+        auto victim = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+            if (it->second.texture.use_count() == 1 && (victim == entries.end() || it->second.lastUse < victim->second.lastUse))
+                victim = it;
+        if (victim == entries.end())
+            return;
+        bytes_ -= victim->second.texture->bytes();
+        entries.erase(victim);
+        stats_.evictions++;
+    }
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    budget_ = bytes;
+    evict(budget_);
+}
+
+size_t TextureCache::bytes()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes_;
+}
+
+void TextureCache::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    evict(0);
+    // Failed loads hold no memory but still count as cached
+    for (auto it = entries.begin(); it != entries.end(); )
+        it = it->second.texture.use_count() == 1 ? entries.erase(it) : std::next(it);
+}
+
+TextureCache::Stats TextureCache::stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats_;
+}
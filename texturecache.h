@@ -0,0 +1,89 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "texture.h"
+
+// Process wide cache of decoded textures keyed by file path, so models
+// sharing a map share one copy of its mip chain. Files are memory mapped and
+// uncompressed ones are tiled straight out of the mapping, rows in either
+// order addressed in place. RLE files are decoded into a temporary image.
+// While the cache holds more than its budget, textures no one else holds
+// are dropped, least recently requested first.
+class TextureCache
+{
+    public:
+    static TextureCache &instance();
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache & operator =(const TextureCache &) = delete;
+
+    // A texture that is decoded, or taken from the cache, on its first get()
+    class Handle
+    {
+        public:
+        Handle() {}
+        // Resolves the texture on the first call, which must not race with
+        // any other call. Once loaded() a handle is only read, so threads
+        // can share it: resolve up front (Model::loadTextures) before
+        // handing it to them.
+        const Texture &get()
+        {
+            if (!texture)
+                resolve();
+            return *texture;
+        }
+        bool loaded() const { return texture != nullptr; }
+        void release() { texture.reset(); }
+
+        private:
+        friend class TextureCache;
+        std::string path;
+        std::shared_ptr<const Texture> texture;
+        void resolve();
+    };
+
+    // Checks that path holds a TGA the cache can decode, the pixels are
+    // only read by the handle's first get(). A failed handle gives an empty
+    // texture.
+    Handle open(const std::string &path, bool *ok = nullptr);
+    // The decoded texture of path, shared with every other caller
+    std::shared_ptr<const Texture> load(const std::string &path);
+
+    void setBudget(size_t bytes);
+    size_t budget() const { return budget_; }
+    // Memory of all the textures in the cache, used or not
+    size_t bytes();
+    // Drop every texture no one else holds
+    void clear();
+
+    struct Stats
+    {
+        long hits, misses, evictions;
+    };
+    Stats stats();
+
+    private:
+    TextureCache();
+
+    struct Entry
+    {
+        std::shared_ptr<const Texture> texture;
+        unsigned long long lastUse;
+    };
+
+    std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+    size_t budget_, bytes_;
+    unsigned long long clock;
+    Stats stats_;
+
+    // Called with the lock held
+    void evict(size_t budget);
+    static std::shared_ptr<const Texture> decode(const std::string &path);
+};
+
+#endif //__TEXTURECACHE_H__
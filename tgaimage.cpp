@@ -3,7 +3,11 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <utility>
+#include <stdint.h>
+#include <algorithm>
 #include "tgaimage.h"
+#include "mappedfile.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -41,6 +45,67 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 }
 
 bool TGAImage::read_tga_file(const char *filename) {
+	MappedFile file(filename);
+	if (!file.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	if (!decode_tga((const unsigned char *)file.data(), file.size()))
+		return false;
+	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
+	return true;
+}
+
+bool TGAImage::decode_tga(const unsigned char *file, size_t size, bool orient) {
+	if (data) delete [] data;
+	data = NULL;
+	width = height = bytespp = 0;
+	TGA_Header header;
+	if (size < sizeof(header)) {
+		std::cerr << "an error occured while reading the header\n";
+		return false;
+	}
+	memcpy((void *)&header, file, sizeof(header));
+	int w   = header.width;
+	int h   = header.height;
+	int bpp = header.bitsperpixel>>3;
+	if (w<=0 || h<=0 || (bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA)) {
+		std::cerr << "bad bpp (or width/height) value\n";
+		return false;
+	}
+	// Skip the image id and colour map
+	size_t pos = sizeof(header) + (unsigned char)header.idlength;
+	if (header.colormaptype)
+		pos += (size_t)(unsigned short)header.colormaplength * (((unsigned char)header.colormapdepth + 7) >> 3);
+	width = w;
+	height = h;
+	bytespp = bpp;
+	unsigned long nbytes = bytespp*width*height;
+	data = new unsigned char[nbytes];
+	bool ok;
+	if (3==header.datatypecode || 2==header.datatypecode) {
+		ok = pos <= size && size - pos >= nbytes;
+		if (ok) memcpy(data, file+pos, nbytes);
+	} else if (10==header.datatypecode||11==header.datatypecode) {
+		ok = pos <= size && decode_rle_data(file+pos, size-pos);
+	} else {
+		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+		return false;
+	}
+	if (!ok) {
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
+	if (orient && !(header.imagedescriptor & 0x20)) {
+		flip_vertically();
+	}
+	if (orient && (header.imagedescriptor & 0x10)) {
+		flip_horizontally();
+	}
+	return true;
+}
+
+bool TGAImage::read_tga_file_stream(const char *filename) {
 	if (data) delete [] data;
 	data = NULL;
 	std::ifstream in;
@@ -146,6 +211,205 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
+	std::vector<unsigned char> file;
+	if (!encode_tga(file, rle)) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	std::ofstream out;
+	out.open (filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		out.close();
+		return false;
+	}
+	out.write((char *)file.data(), file.size());
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		out.close();
+		return false;
+	}
+	out.close();
+	return true;
+}
+
+size_t TGAImage::max_encoded_size() const {
+	// A chunk header per pixel at worst
+	return sizeof(TGA_Header) + (size_t)width*height*(bytespp+1) + 26;
+}
+
+bool TGAImage::encode_tga(std::vector<unsigned char> &out, bool rle, bool bottom_up) const {
+	const unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	const unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	const unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	if (!data) return false;
+	out.clear();
+	out.reserve(max_encoded_size());
+
+	TGA_Header header;
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp<<3;
+	header.width  = width;
+	header.height = height;
+	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = bottom_up ? 0x00 : 0x20; // bottom-left or top-left origin
+	const unsigned char *h = (const unsigned char *)&header;
+	out.insert(out.end(), h, h+sizeof(header));
+	if (!rle) {
+		out.insert(out.end(), data, data+width*height*bytespp);
+	} else if (!encode_rle_data(out)) {
+		return false;
+	}
+	out.insert(out.end(), developer_area_ref, developer_area_ref+sizeof(developer_area_ref));
+	out.insert(out.end(), extension_area_ref, extension_area_ref+sizeof(extension_area_ref));
+	out.insert(out.end(), footer, footer+sizeof(footer));
+	return true;
+}
+
+// Pixel of BPP bytes as an integer, compares a pixel in one go. Assembled
+// from the bytes since a partial memcpy into a word stalls store forwarding.
+template <int BPP>
+static inline uint32_t loadPixel(const unsigned char *p) {
+	uint32_t v = 0;
+	for (int i=0; i<BPP; i++)
+		v |= (uint32_t)p[i] << (8*i);
+	return v;
+}
+
+// Pixels from p on, at most max, equal to the first one. Within a run the
+// bytes repeat with period BPP, so eight bytes are compared with the eight
+// BPP further on at a time.
+template <int BPP>
+static inline int runLength(const unsigned char *p, int max) {
+	size_t limit = (size_t)(max-1)*BPP;
+	size_t y = 0;
+	while (y+8 <= limit) {
+		uint64_t a, b;
+		memcpy(&a, p+y, 8);
+		memcpy(&b, p+y+BPP, 8);
+		if (a != b) break;
+		y += 8;
+	}
+	while (y < limit && p[y] == p[y+BPP]) y++;
+	return y/BPP + 1;
+}
+
+// Length of a raw chunk starting at p, at most max: it ends before the
+// first pixel equal to its successor, which starts a run. Eight bytes are
+// compared with the eight BPP further on, a pair of pixels is equal where
+// BPP consecutive bytes of the difference are zero.
+template <int BPP>
+static inline int rawLength(const unsigned char *p, int max) {
+	const int per_word = 8/BPP;
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t pixel_bits = 0;
+	for (int i=0; i<BPP; i++)
+		pixel_bits |= 0x80ULL << (8*i);
+	int k = 1;
+	for (; (k+1)*BPP + 8 <= max*BPP; k += per_word) {
+		uint64_t a, b;
+		memcpy(&a, p+k*BPP, 8);
+		memcpy(&b, p+(k+1)*BPP, 8);
+		uint64_t x = a ^ b;
+		// 0x80 in every zero byte of x
+		uint64_t zero = ~(((x & low7) + low7) | x | low7);
+		if (zero)
+			for (int i=0; i<per_word; i++)
+				if (((zero >> (8*BPP*i)) & pixel_bits) == pixel_bits) return k+i;
+	}
+	for (; k+1<max; k++)
+		if (loadPixel<BPP>(p+k*BPP) == loadPixel<BPP>(p+(k+1)*BPP)) return k;
+	return max;
+}
+
+// Same chunks as unload_rle_data, written straight into dst
+template <int BPP>
+static unsigned char *encodeRle(const unsigned char *src, unsigned long npixels, unsigned char *dst) {
+	const int max_chunk_length = 128;
+	unsigned long curpix = 0;
+	while (curpix<npixels) {
+		const unsigned char *p = src + curpix*BPP;
+		int max = (int)std::min<unsigned long>(max_chunk_length, npixels-curpix);
+		if (max > 1 && loadPixel<BPP>(p) == loadPixel<BPP>(p+BPP)) {
+			int n = runLength<BPP>(p, max);
+			*dst++ = n+127;
+			memcpy(dst, p, BPP);
+			dst += BPP;
+			curpix += n;
+		} else {
+			int n = rawLength<BPP>(p, max);
+			*dst++ = n-1;
+			memcpy(dst, p, n*BPP);
+			dst += n*BPP;
+			curpix += n;
+		}
+	}
+	return dst;
+}
+
+template <int BPP>
+static bool decodeRle(const unsigned char *src, size_t size, unsigned char *dst, unsigned long npixels) {
+	const unsigned char *end = src + size;
+	unsigned long curpix = 0;
+	while (curpix<npixels) {
+		if (src >= end) return false;
+		unsigned char chunkheader = *src++;
+		unsigned long n = (chunkheader & 127) + 1;
+		if (n > npixels-curpix) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		if (chunkheader<128) {
+			if ((size_t)(end-src) < n*BPP) return false;
+			memcpy(dst, src, n*BPP);
+			src += n*BPP;
+		} else {
+			if (end-src < BPP) return false;
+			if (BPP==1) {
+				memset(dst, *src, n);
+			} else {
+				// Double the filled part until the run is complete
+				memcpy(dst, src, BPP);
+				for (unsigned long filled=1; filled<n; filled*=2)
+					memcpy(dst+filled*BPP, dst, std::min(filled, n-filled)*BPP);
+			}
+			src += BPP;
+		}
+		dst += n*BPP;
+		curpix += n;
+	}
+	return true;
+}
+
+bool TGAImage::encode_rle_data(std::vector<unsigned char> &out) const {
+	unsigned long npixels = width*height;
+	size_t start = out.size();
+	// Room for the worst case, a chunk header per pixel
+	out.resize(start + npixels*(bytespp+1));
+	unsigned char *dst = out.data() + start;
+	switch (bytespp) {
+	case 1: dst = encodeRle<1>(data, npixels, dst); break;
+	case 2: dst = encodeRle<2>(data, npixels, dst); break;
+	case 3: dst = encodeRle<3>(data, npixels, dst); break;
+	case 4: dst = encodeRle<4>(data, npixels, dst); break;
+	default: return false;
+	}
+	out.resize(dst - out.data());
+	return true;
+}
+
+bool TGAImage::decode_rle_data(const unsigned char *src, size_t size) {
+	unsigned long npixels = width*height;
+	switch (bytespp) {
+	case 1: return decodeRle<1>(src, size, data, npixels);
+	case 2: return decodeRle<2>(src, size, data, npixels);
+	case 3: return decodeRle<3>(src, size, data, npixels);
+	case 4: return decodeRle<4>(src, size, data, npixels);
+	}
+	return false;
+}
+
+bool TGAImage::write_tga_file_stream(const char *filename, bool rle) {
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
@@ -267,6 +531,13 @@ int TGAImage::get_bytespp() {
 	return bytespp;
 }
 
+void TGAImage::swap(TGAImage &img) {
+	std::swap(data, img.data);
+	std::swap(width, img.width);
+	std::swap(height, img.height);
+	std::swap(bytespp, img.bytespp);
+}
+
 int TGAImage::get_width() {
 	return width;
 }
@@ -2,6 +2,7 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <vector>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -89,6 +90,9 @@ protected:
 
 	bool   load_rle_data(std::ifstream &in);
 	bool unload_rle_data(std::ofstream &out);
+	// In memory codec used by read_tga_file and write_tga_file
+	bool decode_rle_data(const unsigned char *src, size_t size);
+	bool encode_rle_data(std::vector<unsigned char> &out) const;
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
@@ -97,8 +101,23 @@ public:
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	// The file is memory mapped and decoded in place, and written with a
+	// single write of the encoded buffer
 	bool read_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle=true);
+	// The original std::ifstream/std::ofstream chunk by chunk codec, kept as
+	// a reference for tests and benchmarks
+	bool read_tga_file_stream(const char *filename);
+	bool write_tga_file_stream(const char *filename, bool rle=true);
+	// Parse a whole TGA file held in memory. Without orient the rows and
+	// pixels stay in the file's order, see the descriptor bits for which.
+	bool decode_tga(const unsigned char *file, size_t size, bool orient=true);
+	// The whole file into out, which keeps its capacity between calls.
+	// bottom_up marks the rows as stored bottom first, so an image drawn
+	// with y up needs no flip_vertically() before encoding.
+	bool encode_tga(std::vector<unsigned char> &out, bool rle=true, bool bottom_up=false) const;
+	// Upper bound of encode_tga's output
+	size_t max_encoded_size() const;
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -106,6 +125,8 @@ public:
 	bool set(int x, int y, TGAColor c);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
+	// Exchange pixels and dimensions without copying
+	void swap(TGAImage &img);
 	int get_width();
 	int get_height();
 	int get_bytespp();
@@ -0,0 +1,102 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int nthreads)
+    :batch(nullptr), generation(0), busy(0), quit(false)
+{
+    if (nthreads <= 0)
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nworkers = nthreads;
+    queues = std::vector<Queue>(nworkers);
+
+    for (int i = 1; i < nworkers; i++)
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void ThreadPool::run(int njobs, const std::function<void(int, int)> &job)
+{
+    if (njobs <= 0)
+        return;
+
+    for (int i = 0; i < njobs; i++)
+        queues[i % nworkers].jobs.push_back(i);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        batch = &job;
+        busy = nworkers;
+        generation++;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return busy == 0; });
+    batch = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+    int seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+        drain(worker);
+    }
+}
+
+void ThreadPool::drain(int worker)
+{
+    int job;
+    while (pop(worker, job))
+        (*batch)(worker, job);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (--busy == 0)
+        done.notify_all();
+}
+
+bool ThreadPool::pop(int worker, int &job)
+{
+    {
+        Queue &own = queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Own queue is empty, steal from the back of another worker
+    for (int i = 1; i < nworkers; i++)
+    {
+        Queue &victim = queues[(worker + i) % nworkers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
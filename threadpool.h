@@ -0,0 +1,51 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+// Fixed pool of workers executing a batch of indexed jobs.
+// Jobs are dealt round robin into per worker deques, a worker pops from the
+// front of its own deque and steals from the back of the others once empty.
+// The calling thread takes part as worker 0 so nthreads is the total parallelism.
+class ThreadPool
+{
+    public:
+    ThreadPool(int nthreads = 0);
+    ~ThreadPool();
+
+    int size() const { return nworkers; }
+
+    // Run job(worker, index) for every index in [0, njobs), blocks until done
+    void run(int njobs, const std::function<void(int, int)> &job);
+
+    private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<int> jobs;
+    };
+
+    int nworkers;
+    std::vector<std::thread> threads;
+    std::vector<Queue> queues;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)> *batch;
+    int generation;
+    int busy;
+    bool quit;
+
+    void workerLoop(int worker);
+    void drain(int worker);
+    bool pop(int worker, int &job);
+};
+
+#endif //__THREADPOOL_H__